@@ -0,0 +1,160 @@
+/* aes_wrapper.h - Password-based payload encryption
+ *
+ * Encrypts/decrypts a struct Payload in place, with AES-256-CBC or
+ * ChaCha20-Poly1305. The key is derived from the password with
+ * PBKDF2-HMAC-SHA256; see aes_wrapper.c for the exact layout of the
+ * encrypted buffer.
+ */
+
+#ifndef AES_WRAPPER_H
+#define AES_WRAPPER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct Payload;
+
+/* Payload ciphers. The id is also what the image metadata records in its
+ * "encrypted" byte, so 0 means a plain payload. */
+#define PAYLOAD_CIPHER_AES256_CBC 1
+#define PAYLOAD_CIPHER_CHACHA20_POLY1305 2
+
+    /* Encrypt payload->data in place with cipher (PAYLOAD_CIPHER_*);
+     * payload->encrypted is set on success. */
+    int aes_encrypt_inplace(struct Payload *payload, int cipher, const char *password);
+
+    /* Decrypt payload->data in place; payload->encrypted is cleared on success.
+     * Returns -6 for a wrong password. Payloads carrying a key check value
+     * are rejected before the ciphertext is touched; for legacy payloads the
+     * buffer may no longer hold valid ciphertext after a failed decrypt.
+     * The cipher is read from the header; a ChaCha20-Poly1305 payload whose
+     * tag does not verify returns -9 without being decrypted. Either
+     * direction returns STEGO_CANCELLED (cancel.h) if the key derivation
+     * was cancelled. */
+    int aes_decrypt_inplace(struct Payload *payload, const char *password);
+
+    /* ---- KDF cost ----
+     * Password-based payloads record the PBKDF2 iteration count in their
+     * header, so the cost can be changed per deployment without breaking
+     * existing images. The setting is process-wide; set it before starting
+     * any encryption. */
+
+#define AES_KDF_DEFAULT_ITERATIONS 100000
+
+    void aes_set_kdf_iterations(uint32_t iterations);
+
+    uint32_t aes_get_kdf_iterations(void);
+
+    /* Measure this machine's PBKDF2 rate and return the iteration count that
+     * takes about target_ms. Does not change the current setting. */
+    uint32_t aes_calibrate_kdf(unsigned target_ms);
+
+    /* ---- Raw-key mode ----
+     * For callers that already hold key material: no PBKDF2 is run on either
+     * side and the header records that the payload needs a raw key. */
+
+#define AES_RAW_KEY_LEN 32
+
+    int aes_encrypt_with_key(struct Payload *payload, int cipher, const unsigned char key[AES_RAW_KEY_LEN]);
+
+    int aes_decrypt_with_key(struct Payload *payload, const unsigned char key[AES_RAW_KEY_LEN]);
+
+    /* Load a key file holding either 32 raw bytes or 64 hex digits. */
+    int aes_load_key_file(const char *path, unsigned char key[AES_RAW_KEY_LEN]);
+
+    /* ---- Batch keys ----
+     * Opt-in for encoding many payloads with one password: the batch key
+     * holds a random batch salt, and PBKDF2 runs once (on first use, in
+     * whichever thread gets there first). Each payload still gets its own
+     * key through HKDF over a per-item nonce. Decrypting such payloads with
+     * aes_decrypt_inplace() caches the batch master, so decoding a batch
+     * pays PBKDF2 once as well. Batch keys are reference counted and may
+     * be shared between threads. */
+
+    struct AesBatchKey;
+
+    int aes_batch_key_new(struct AesBatchKey **out, const char *password);
+
+    struct AesBatchKey *aes_batch_key_ref(struct AesBatchKey *bk);
+
+    void aes_batch_key_unref(struct AesBatchKey *bk);
+
+    int aes_encrypt_with_batch_key(struct Payload *payload, int cipher, struct AesBatchKey *bk);
+
+    /* Forget all cached batch masters. */
+    void aes_key_cache_clear(void);
+
+    /* ---- Streaming encryption ----
+     * Same output as aes_encrypt_inplace(), produced incrementally: the
+     * encryption header is passed to the sink by aes_stream_init(), ciphertext
+     * follows in AES_STREAM_CHUNK-byte pieces, and aes_stream_final() emits
+     * the padded tail (AES) or the authentication tag (ChaCha20-Poly1305).
+     * A non-zero return from the sink aborts the stream. */
+
+#define AES_STREAM_CHUNK (64 * 1024)
+
+    typedef int (*AesStreamSink)(void *ctx, const unsigned char *data, size_t len);
+
+    struct AesStream;
+
+    /* Total number of bytes the stream produces for plain_len input bytes. */
+    size_t aes_encrypted_size(int cipher, size_t plain_len);
+
+    int aes_stream_init(struct AesStream **out, int cipher, const char *password, AesStreamSink sink, void *sink_ctx);
+
+    int aes_stream_init_with_key(struct AesStream **out, int cipher, const unsigned char key[AES_RAW_KEY_LEN], AesStreamSink sink, void *sink_ctx);
+
+    int aes_stream_init_with_batch_key(struct AesStream **out, int cipher, struct AesBatchKey *bk, AesStreamSink sink, void *sink_ctx);
+
+    /* The init calls do all of the key derivation. Given a NULL sink they
+     * stop there, so the KDF can run before the ciphertext has anywhere to
+     * go; the header is emitted once the sink is set here (once only). */
+    int aes_stream_set_sink(struct AesStream *s, AesStreamSink sink, void *sink_ctx);
+
+    int aes_stream_update(struct AesStream *s, const unsigned char *data, size_t len);
+
+    /* Feed the whole file at path through the stream; -2 if it cannot be
+     * opened, -8 on a read error. aes_stream_final() still follows. */
+    int aes_stream_update_from_file(struct AesStream *s, const char *path);
+
+    int aes_stream_final(struct AesStream *s);
+
+    void aes_stream_free(struct AesStream *s);
+
+    /* Read a file in chunks and push it through a stream into sink. */
+    int aes_stream_encrypt_file(const char *path, int cipher, const char *password, AesStreamSink sink, void *sink_ctx);
+
+    int aes_stream_encrypt_file_with_key(const char *path, int cipher, const unsigned char key[AES_RAW_KEY_LEN], AesStreamSink sink, void *sink_ctx);
+
+    int aes_stream_encrypt_file_with_batch_key(const char *path, int cipher, struct AesBatchKey *bk, AesStreamSink sink, void *sink_ctx);
+
+    /* ---- SHA-256 ----
+     * The hash under the KDF, exposed for content digests (result_cache.c).
+     * Not a password hash: never store it for secret inputs. */
+
+#define AES_SHA256_LEN 32
+
+    struct AesSha256Ctx
+    {
+        uint32_t state[8];
+        uint64_t bitlen;
+        uint8_t data[64];
+        size_t datalen;
+    };
+
+    void aes_sha256_init(struct AesSha256Ctx *ctx);
+
+    void aes_sha256_update(struct AesSha256Ctx *ctx, const void *data, size_t len);
+
+    void aes_sha256_final(struct AesSha256Ctx *ctx, unsigned char out[AES_SHA256_LEN]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AES_WRAPPER_H */
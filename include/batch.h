@@ -4,6 +4,9 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+struct AesBatchKey;
+struct ResultCache;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -12,28 +15,85 @@ extern "C"
     typedef void (*BatchProgressCallback)(const char *task_id, double progress);
     typedef void (*BatchCompleteCallback)(const char *task_id, gboolean success);
 
-    typedef void (*BatchProgressCb)(gpointer user_data, double fraction);
-
     typedef void (*BatchFinishedCb)(gpointer user_data, gboolean success, const char *message);
 
+    /* Queued tasks start highest priority first, in submission order
+     * within a priority. */
+    typedef enum
+    {
+        BATCH_PRIORITY_HIGH,
+        BATCH_PRIORITY_NORMAL,
+        BATCH_PRIORITY_LOW,
+        BATCH_PRIORITY_COUNT
+    } BatchPriority;
+
+    /* Pipeline stages; each has its own pool of worker threads. A task
+     * moves through them in order (skipping those it does not need), the
+     * next one at a time:
+     *   READ   JPEG conversion, PNG/BMP decode, payload load
+     *   KDF    PBKDF2 and encryption setup; decryption when decoding
+     *   EMBED  embedding or extraction
+     *   WRITE  PNG encode and write, or writing the extracted files */
+    typedef enum
+    {
+        BATCH_STAGE_READ,
+        BATCH_STAGE_KDF,
+        BATCH_STAGE_EMBED,
+        BATCH_STAGE_WRITE,
+        BATCH_STAGE_COUNT
+    } BatchStage;
+
+    /* Both calls queue the task and return at once; it runs on a worker
+     * thread when the scheduler admits it (batch_scheduler_set_limits()). */
     GTask *batch_encode_async(const char *cover_path,
                               const char *payload_path,
                               const char *out_path,
                               int lsb_depth,
                               const char *password,
-                              BatchProgressCb progress_cb,
+                              int cipher, /* PAYLOAD_CIPHER_*, used with a password */
+                              struct AesBatchKey *batch_key, /* optional, replaces password */
+                              BatchPriority priority,
                               BatchFinishedCb finished_cb,
                               gpointer user_data);
 
     GTask *batch_decode_async(const char *stego_path,
                               const char *out_dir,
                               const char *password,
-                              BatchProgressCb progress_cb,
+                              BatchPriority priority,
                               BatchFinishedCb finished_cb,
                               gpointer user_data);
 
+    /* How far the task is, 0 while it is queued and 1 once it has succeeded.
+     * A cheap atomic read that wakes nothing, meant to be polled from a UI
+     * timer; the value is updated from inside the long-running stages. */
+    double batch_task_get_progress(GTask *task);
+
+    /* Stop a task. A queued one is dropped at once; a running one stops at
+     * its next check (between stages, and every few milliseconds inside
+     * key derivation, embedding, extraction and PNG coding), frees its
+     * buffers and removes any partial output. Either way finished_cb
+     * reports failure with the message "Cancelled", unless the task had
+     * already got past its last check. */
     void batch_task_cancel(GTask *task);
 
+    /* Reuse results of unencrypted encodes whose inputs have not changed
+     * (result_cache.h). Process-wide; set before starting tasks, NULL to
+     * turn it off. The cache must outlive every task started with it. */
+    void batch_set_result_cache(struct ResultCache *cache);
+
+    /* At most max_jobs tasks are in the pipeline at once (0: two per core,
+     * enough to keep every stage busy), and a task is only started while
+     * the estimated peak memory of the started ones, its own included,
+     * stays within memory_budget bytes (0: half of the physical memory).
+     * The estimate comes from the image dimensions and payload size; a
+     * task is started on a guess from its file sizes, corrected once its
+     * image has been read. */
+    void batch_scheduler_set_limits(guint max_jobs, guint64 memory_budget);
+
+    /* Worker threads of one stage (0: one per core). Takes effect for
+     * steps queued from now on. */
+    void batch_pipeline_set_workers(BatchStage stage, guint workers);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,35 @@
+/* cancel.h - Cooperative cancellation of long-running core work
+ *
+ * A thread running a cancellable job installs a check with
+ * cancel_set_check(). The long loops of the core (PBKDF2, the LSB embed
+ * and extract kernels, PNG row coding) poll it every few milliseconds of
+ * work and give up with STEGO_CANCELLED, freeing what they allocated.
+ * The check is per thread; with none installed nothing is cancelled.
+ */
+
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Returned by any core call that stopped because of a cancellation */
+#define STEGO_CANCELLED (-13)
+
+    /* Nonzero once the job should stop; must be safe to call from the
+     * thread that installed it while another thread cancels. */
+    typedef int (*CancelCheckFn)(void *ctx);
+
+    /* Install fn(ctx) for the calling thread; NULL removes it. */
+    void cancel_set_check(CancelCheckFn fn, void *ctx);
+
+    /* Nonzero if the calling thread's job has been cancelled. */
+    int cancel_requested(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CANCEL_H */
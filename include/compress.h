@@ -0,0 +1,44 @@
+/* compress.h - Optional payload compression before encryption/embedding
+ *
+ * Fewer payload bytes means fewer channel bytes to touch and a smaller
+ * cover requirement. Two methods are offered: zlib (good ratio) and a small
+ * in-tree LZ77 codec (very fast, weaker ratio). The method id and the
+ * original size travel in the image metadata.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct Payload;
+
+#define PAYLOAD_COMPRESS_NONE 0
+#define PAYLOAD_COMPRESS_ZLIB 1
+#define PAYLOAD_COMPRESS_LZ 2
+
+/* Neither codec expands by more than ~1000x: an original size above
+ * compressed size * COMPRESS_MAX_RATIO can only come from a bad header. */
+#define COMPRESS_MAX_RATIO 1100
+
+    /* Compress payload->data in place with method. If the result would not
+     * be smaller the payload is left untouched. *used_method receives the
+     * method actually applied (PAYLOAD_COMPRESS_NONE in that case). */
+    int compress_payload(struct Payload *payload, int method, int *used_method);
+
+    /* Decompress src into dst, which must hold exactly original_size bytes. */
+    int decompress_buffer(int method, const unsigned char *src, size_t src_len, unsigned char *dst, size_t original_size);
+
+    /* Replace payload->data with its decompressed form. */
+    int decompress_payload(struct Payload *payload, int method, size_t original_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,26 @@
+/* crc32c.h - CRC-32C (Castagnoli) checksum used for embedded payloads
+ *
+ * Uses the SSE4.2 crc32 instruction when the CPU has it and a slicing
+ * table otherwise; both give the same result.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Extend crc over len bytes. Start with crc = 0; chunks may be fed in
+     * any sizes. */
+    uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRC32C_H */
@@ -5,6 +5,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +20,19 @@ struct Image {
 
 int image_load(const char *path, struct Image *out);
 
+/* Load only the top rows of a PNG or BMP image, enough for min_bytes of
+ * pixel data (or the whole image if it is smaller); out->height is the
+ * number of rows loaded. JPEGs are always loaded whole. */
+int image_load_head(const char *path, size_t min_bytes, struct Image *out);
+
+/* Dimensions and channel count image_load() would return, read from the
+ * file header without decoding any pixels. */
+int image_read_info(const char *path, int *width, int *height, int *channels);
+
+/* PNG rows are coded with a cancellation check (cancel.h) and a
+ * progress update (progress.h) per row; a cancelled load or save returns
+ * STEGO_CANCELLED, and a save that fails for any reason removes the
+ * partial file. */
 int image_save(const char *path, const struct Image *img);
 
 void image_free(struct Image *img);
@@ -27,6 +41,20 @@ int image_is_jpeg(const char *path);
 
 int image_convert_jpeg_to_png(const char *input_path, const char *output_path);
 
+/* Stream forms for pipes: the stream is read or written front to back and
+ * left open. The input format (PNG, JPEG or BMP) is detected from its
+ * first byte and always comes back as RGBA, as a PNG would; output is
+ * always PNG. */
+int image_load_stream(FILE *f, struct Image *out);
+
+/* image_load_head() for a stream, format detected as above */
+int image_load_head_stream(FILE *f, size_t min_bytes, struct Image *out);
+
+int image_save_stream(FILE *f, const struct Image *img);
+
+/* 1 if f is positioned at a JPEG; nothing is consumed. */
+int image_stream_is_jpeg(FILE *f);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,61 @@
+/* manifest.h - Job lists for headless batch encoding
+ *
+ * A manifest holds one encode job per line, either as CSV
+ *
+ *     cover,payload,out[,depth[,password_ref]]
+ *
+ * (fields may be double-quoted, "" inside quotes is a literal quote, and a
+ * first line starting with the field "cover" is taken as a header) or as
+ * a JSON object per line with the same keys:
+ *
+ *     {"cover": "a.png", "payload": "a.txt", "out": "a_stego.png", "depth": 2}
+ *
+ * Both kinds of line may be mixed. Blank lines and lines starting with '#'
+ * are skipped. Passwords never appear in a manifest: password_ref names
+ * where to find one, as "env:NAME" (an environment variable) or
+ * "file:PATH" (the first line of a file).
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct ManifestJob
+    {
+        unsigned line; /* 1-based line of the manifest */
+        char *cover;
+        char *payload;
+        char *out;
+        int lsb_depth;      /* 1..3, 0 if not given */
+        char *password_ref; /* NULL if not given */
+    };
+
+    struct Manifest
+    {
+        struct ManifestJob *jobs;
+        size_t count;
+    };
+
+    /* Read every job of the manifest at path ("-" for stdin). Returns -2 if
+     * it cannot be read, -3 for a malformed line (its number goes to
+     * *bad_line, which may be NULL) and -4 if out of memory. */
+    int manifest_load(const char *path, struct Manifest *out, unsigned *bad_line);
+
+    void manifest_free(struct Manifest *m);
+
+    /* Look up the password a password_ref names; *password is malloc'd.
+     * Returns -2 for an unset variable or unreadable file and -3 for a
+     * reference of unknown kind. */
+    int manifest_resolve_password(const char *ref, char **password);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MANIFEST_H */
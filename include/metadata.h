@@ -12,6 +12,21 @@ extern "C"
 {
 #endif
 
+/* On-image record formats. v1 is a fixed 273-byte record, v2 a compact
+ * one with varints and a length-prefixed filename. Both are parsed. */
+#define METADATA_VERSION_1 1
+#define METADATA_VERSION_2 2
+#define METADATA_VERSION_CURRENT METADATA_VERSION_2
+
+/* Upper bound on the number of shards one payload may be split into */
+#define METADATA_MAX_SHARDS 4096
+
+/* Upper bound on shards in an erasure-coded set (GF(2^8) code) */
+#define METADATA_MAX_CODED_SHARDS 256
+
+/* Byte offset of the 4-byte payload checksum inside a v2 record */
+#define METADATA_V2_CRC_OFFSET 4
+
     /* Metadata structure representing embedded header info. */
     struct Metadata
     {
@@ -20,9 +35,30 @@ extern "C"
         uint64_t file_size; /* original payload size */
         int lsb_depth;      /* 1..3 */
         bool encrypted;     /* AES applied? */
+        uint8_t cipher;     /* PAYLOAD_CIPHER_* (aes_wrapper.h), 0 if plain */
+        uint8_t compression;    /* PAYLOAD_COMPRESS_* (compress.h) */
+        uint64_t original_size; /* size before compression */
+        uint8_t version;        /* METADATA_VERSION_*; serialize writes v1 only if asked */
+        bool has_crc;           /* crc32c present (v2 only) */
+        uint32_t crc32c;        /* CRC-32C of the embedded payload bytes */
+        bool archive;           /* payload is a multi-file archive (v2 only) */
+        /* Sharded payloads (v2 only): file_size is this image's share;
+         * the other fields describe the whole payload. */
+        bool sharded;
+        uint64_t payload_id;   /* random, shared by all shards */
+        uint32_t shard_index;  /* 0..shard_count-1 */
+        uint32_t shard_count;
+        uint64_t shard_offset; /* of this shard within the payload */
+        uint64_t total_size;   /* of the whole payload */
+        /* Erasure-coded sets: any data_shards of the shard_count images
+         * rebuild the payload. Every shard then holds file_size =
+         * ceil(total_size / data_shards) bytes and shard_offset is 0.
+         * Equal to shard_count for a plain split. */
+        uint32_t data_shards;
     };
 
-    /* Create metadata for a given payload and configuration. */
+    /* Create metadata for a given payload and configuration. An encrypted
+     * payload is recorded as AES-256-CBC; set cipher afterwards for others. */
     struct Metadata metadata_create_from_payload(const char *filename, size_t file_size, int lsb_depth, bool encrypted);
 
     /* Free metadata (no dynamic members here, but for symmetry). */
@@ -2,12 +2,18 @@
  *
  * Provides a simple API to load a payload from disk into memory, write an
  * extracted payload back to disk, and free payload buffers.
+ *
+ * Large files are not copied in: payload_load_from_file() maps them
+ * read-only and the payload references the mapping (map_len != 0). Code
+ * that modifies payload->data in place or reallocates it must call
+ * payload_make_owned() first. The file must not be truncated while mapped.
  */
 
 #ifndef PAYLOAD_H
 #define PAYLOAD_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -19,16 +25,83 @@ extern "C"
         unsigned char *data;
         size_t size;
         int encrypted;
+        size_t map_len; /* non-zero: data is a read-only file mapping */
     };
 
     int payload_load_from_file(const char *path, struct Payload *out);
 
+    /* Read everything from fd (e.g. stdin) up to EOF. A regular file at
+     * offset 0 is loaded as by path; pipes are read into a growing buffer. */
+    int payload_load_from_fd(int fd, struct Payload *out);
+
+    /* Replace a mapped payload's data with a malloc'd copy; no-op for
+     * payloads that already own their buffer. */
+    int payload_make_owned(struct Payload *p);
+
     int payload_from_text(const char *text, struct Payload *out);
 
     int payload_write_to_file(const struct Payload *payload, const char *outpath);
 
+    /* Write the payload to an open descriptor (e.g. stdout); fd stays open. */
+    int payload_write_to_fd(const struct Payload *payload, int fd);
+
     void payload_free(struct Payload *p);
 
+    /* ---- Archive payloads ----
+     * Several files packed into one payload (metadata flag "archive"):
+     *   [index_len varint][index][bodies]
+     *   index := [count varint] count x [name_len varint][name]
+     *                                    [offset varint][size varint][flags]
+     * Offsets are relative to the start of the bodies, so a reader needs
+     * only the index and the byte range of the entry it wants. Names are
+     * plain file names (no directories). */
+
+#define PAYLOAD_ARCHIVE_F_EXEC 0x01 /* restore the executable bit */
+
+    struct PayloadArchiveEntry
+    {
+        char name[256];
+        uint64_t offset; /* from the start of the bodies */
+        uint64_t size;
+        uint8_t flags;
+    };
+
+    struct PayloadArchive
+    {
+        struct PayloadArchiveEntry *entries;
+        size_t count;
+        uint64_t bodies_offset; /* from the start of the archive */
+    };
+
+    /* True if name (len bytes, not NUL-terminated) is a plain file name that
+     * can be written to out_dir/name on extraction: not empty, "." or "..",
+     * and free of path separators. */
+    int payload_name_ok(const char *name, size_t len);
+
+    /* Pack regular files into an archive payload, stored under their base
+     * names. Returns -7 for duplicate names. */
+    int payload_archive_build(const char *const *paths, size_t count, struct Payload *out);
+
+    /* From the first avail bytes of an archive, work out how many leading
+     * bytes (length prefix plus index) payload_archive_open() needs.
+     * VARINT_MAX_LEN bytes are always enough to answer. */
+    int payload_archive_header_len(const unsigned char *buf, size_t avail, size_t *need);
+
+    /* Parse the index at the start of buf (at least header_len bytes) for an
+     * archive of total_len bytes. Every entry is checked to lie inside it. */
+    int payload_archive_open(const unsigned char *buf, size_t buf_len, uint64_t total_len, struct PayloadArchive *out);
+
+    const struct PayloadArchiveEntry *payload_archive_find(const struct PayloadArchive *a, const char *name);
+
+    void payload_archive_free(struct PayloadArchive *a);
+
+    /* Write one entry's bytes to out_dir/name, restoring its flags. */
+    int payload_archive_write_entry(const struct PayloadArchiveEntry *e, const unsigned char *data, const char *out_dir);
+
+    /* Write every entry of an in-memory archive (or only the one called
+     * name, if not NULL) into out_dir. Returns -8 if name is not found. */
+    int payload_archive_extract(const struct Payload *archive, const char *name, const char *out_dir);
+
 #ifdef __cplusplus
 }
 #endif
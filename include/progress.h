@@ -0,0 +1,40 @@
+/* progress.h - Progress of long-running core work
+ *
+ * A thread running a job points the core at the job's progress counter
+ * with progress_set_sink() and marks out each stage of the job with
+ * progress_set_stage(). The long loops of the core (PBKDF2, the LSB embed
+ * and extract kernels, PNG row coding) report how far into their stage
+ * they are at the same points where they check for cancellation
+ * (cancel.h). An update is a relaxed atomic store to the counter: nothing
+ * is allocated and nobody is woken, so a UI samples the counter on its
+ * own timer. The counter only moves forward.
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Counter value of a finished job */
+#define PROGRESS_ONE 65536u
+
+    /* Report the calling thread's progress into *counter (read it with an
+     * atomic load); NULL stops reporting. */
+    void progress_set_sink(unsigned int *counter);
+
+    /* The work that follows takes the job from start to end (0..1). */
+    void progress_set_stage(double start, double end);
+
+    /* done of total units of the current stage are complete. */
+    void progress_update(uint64_t done, uint64_t total);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROGRESS_H */
@@ -0,0 +1,34 @@
+/* reed_solomon.h - Systematic Reed-Solomon erasure code over GF(2^8)
+ *
+ * k data shards are extended with m parity shards (k + m <= 256, all the
+ * same length) so that any k of the k + m shards rebuild the data. The
+ * parity rows form a Cauchy matrix, which keeps every k x k submatrix of
+ * the code invertible. Region arithmetic uses SSSE3/AVX2 pshufb nibble
+ * tables when the CPU has them and a full multiplication table otherwise.
+ */
+
+#ifndef REED_SOLOMON_H
+#define REED_SOLOMON_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define RS_MAX_SHARDS 256
+
+    /* Compute parity[0..m) from data[0..k), each len bytes. */
+    int rs_encode(size_t k, size_t m, size_t len, const unsigned char *const *data, unsigned char *const *parity);
+
+    /* shards[0..k+m) are len-byte buffers, present[i] non-zero where shard i
+     * holds valid data. Missing data shards (i < k) are rebuilt in place;
+     * parity shards are not. Returns -3 if fewer than k shards are present. */
+    int rs_reconstruct(size_t k, size_t m, size_t len, unsigned char *const *shards, const int *present);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REED_SOLOMON_H */
@@ -0,0 +1,64 @@
+/* result_cache.h - On-disk cache of encode results
+ *
+ * Maps a content key (SHA-256 over the cover bytes, the payload bytes and
+ * every parameter that changes the output) to a stego PNG written by an
+ * earlier run. On a hit the stored image is copied to the requested output
+ * (a reflink where the filesystem supports it), skipping image decoding,
+ * embedding and PNG compression. Entries live as <hex key>.png in the
+ * cache directory; once their total size passes the limit the least
+ * recently used ones are deleted. A cache may be shared between threads,
+ * and several processes may use the same directory.
+ *
+ * Only unencrypted jobs are cached: an encrypted job is meant to produce
+ * new ciphertext every run, and keying it would put a value derived from
+ * the password on disk.
+ */
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define RESULT_CACHE_KEY_LEN 32
+#define RESULT_CACHE_DEFAULT_MAX_BYTES (1024ull * 1024 * 1024)
+
+    struct ResultCache;
+
+    struct ResultCacheKey
+    {
+        unsigned char digest[RESULT_CACHE_KEY_LEN];
+    };
+
+    /* Open (creating if needed) the cache in dir, holding at most max_bytes
+     * of entries. Existing entries are indexed, oldest use first. */
+    int result_cache_open(const char *dir, uint64_t max_bytes, struct ResultCache **out);
+
+    void result_cache_close(struct ResultCache *cache);
+
+    /* $STEGO_CACHE_DIR, else $XDG_CACHE_HOME/stego-c-practice, else
+     * ~/.cache/stego-c-practice. Returns -1 if no location is known. */
+    int result_cache_default_dir(char *buf, size_t len);
+
+    /* Key for embedding payload_path (recorded under payload_name) into
+     * cover_path. Returns -2 if either file cannot be read. */
+    int result_cache_key(const char *cover_path, const char *payload_path, const char *payload_name,
+                         int lsb_depth, int compression, struct ResultCacheKey *key);
+
+    /* Copy the cached result for key to out_path. Returns 0 on a hit, 1 on a
+     * miss and a negative code if the copy failed (out_path is untouched). */
+    int result_cache_fetch(struct ResultCache *cache, const struct ResultCacheKey *key, const char *out_path);
+
+    /* Record out_path, a freshly written result, under key. */
+    int result_cache_store(struct ResultCache *cache, const struct ResultCacheKey *key, const char *out_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESULT_CACHE_H */
@@ -0,0 +1,44 @@
+/* scan.h - Find the images in a directory tree that carry a payload
+ *
+ * The tree is walked on the calling thread while a bounded pool of workers
+ * probes the files. Each file is opened by the walker and the kernel is
+ * asked to read its head ahead, so by the time a worker picks it up the
+ * bytes are usually cached. Formats are told from content, not extension;
+ * only PNG and BMP images are probed (a JPEG cannot keep LSB data), and of
+ * those only the top rows that can hold a metadata header are decoded.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct Metadata;
+
+    struct ScanStats
+    {
+        uint64_t files;  /* regular files seen */
+        uint64_t images; /* PNG/BMP files probed */
+        uint64_t hits;   /* images holding a valid metadata header */
+        uint64_t errors; /* files or directories that could not be read */
+    };
+
+    /* Called once per hit, never concurrently with itself. */
+    typedef void (*scan_hit_fn)(void *ctx, const char *path, const struct Metadata *meta);
+
+    /* Scan every regular file under root (symlinks are not followed) with
+     * up to threads workers, 0 meaning one per core. stats may be NULL.
+     * Returns -2 if root cannot be opened as a directory. */
+    int stego_scan_dir(const char *root, size_t threads, scan_hit_fn on_hit, void *ctx, struct ScanStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_H */
@@ -0,0 +1,70 @@
+/* shard.h - Split one payload across several cover images
+ *
+ * Each image carries a contiguous slice of the payload plus a v2 metadata
+ * record with the shard fields (random payload id, shard index and count,
+ * offset, total size). The payload is split in proportion to each cover's
+ * capacity, so the combined capacity of all covers is usable. Shards are
+ * embedded and read back in parallel, and on decode the images may be
+ * given in any order.
+ *
+ * An erasure-coded set instead cuts the payload into k equal stripes and
+ * adds n - k Reed-Solomon parity stripes, one stripe per image; any k of
+ * the n images rebuild the payload, so up to n - k may be lost, fail to
+ * load or fail their checksum.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct Image;
+    struct Payload;
+    struct Metadata;
+
+    /* Embed payload across count covers; outs receives count images.
+     * meta describes the whole payload (name, cipher, compression, ...).
+     * Returns -5 if the covers together are too small. */
+    int stego_embed_sharded(const struct Image *covers, size_t count,
+                            const struct Payload *payload, const struct Metadata *meta,
+                            int lsb_depth, struct Image *outs);
+
+    /* Embed payload as an erasure-coded set of count images, any
+     * data_shards (1 <= data_shards < count <= METADATA_MAX_CODED_SHARDS)
+     * of which rebuild it. Each cover must hold a whole stripe of
+     * ceil(size / data_shards) bytes; returns -5 otherwise. */
+    int stego_embed_erasure(const struct Image *covers, size_t count, size_t data_shards,
+                            const struct Payload *payload, const struct Metadata *meta,
+                            int lsb_depth, struct Image *outs);
+
+    /* Reassemble a payload from its shards. For a plain split returns -3 if
+     * the images are not exactly one complete set of shards, -10 if a shard
+     * fails its checksum. For a coded set, shards that cannot be read, fail
+     * their checksum or belong to another payload are skipped; -3 (or -10
+     * if checksums failed) means fewer than data_shards were usable. Like
+     * stego_extract(), plain compressed payloads come back decompressed;
+     * meta_out->file_size is the whole payload's size. */
+    int stego_extract_sharded(const struct Image *stegos, size_t count,
+                              struct Metadata *meta_out, struct Payload *payload_out);
+
+    /* File-level forms: images are loaded, embedded and saved in parallel.
+     * Shard i of n is written as out_dir/<cover name>-<i+1>-of-<n>.png.
+     * data_shards 0 (or count) makes a plain split, fewer a coded set.
+     * Decoding skips images that fail to load as long as any loaded. */
+    int shard_encode_files(const char *const *cover_paths, size_t count, size_t data_shards,
+                           const struct Payload *payload, const struct Metadata *meta,
+                           int lsb_depth, const char *out_dir);
+
+    int shard_decode_files(const char *const *stego_paths, size_t count,
+                           struct Metadata *meta_out, struct Payload *payload_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHARD_H */
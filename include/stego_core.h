@@ -8,6 +8,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 
 #ifdef __cplusplus
@@ -18,6 +19,9 @@ struct Image;
 struct Payload;
 struct Metadata;
 
+/* Bytes the image can carry at lsb_depth, headers included */
+size_t stego_capacity_bytes(const struct Image *img, int lsb_depth);
+
 int stego_embed(
 const struct Image *cover,
 const struct Payload *payload,
@@ -26,12 +30,90 @@ int lsb_depth,
 struct Image *out
 );
 
+/* Chunked embedding: stego_embed_begin() copies the cover into out and
+ * writes the metadata header for a payload of exactly payload_size bytes
+ * (v2 headers get a CRC-32C of the payload, patched in by stego_embed_end());
+ * the payload is then fed in any number of stego_embed_write() calls and
+ * stego_embed_end() checks that all of it arrived. stego_embed() is the
+ * one-shot form of the same sequence. Writes check for cancellation
+ * (cancel.h) between 64 KiB blocks and return STEGO_CANCELLED; out is
+ * then left for the caller to free. */
+struct StegoWriter {
+struct Image *out;
+int lsb_depth;
+size_t bit_pos;      /* next stream bit to write */
+size_t payload_left; /* payload bytes still expected */
+uint32_t crc;        /* running CRC-32C of the payload */
+size_t crc_bit_pos;  /* stream bit of the metadata checksum, 0 if none */
+};
+
+int stego_embed_begin(
+const struct Image *cover,
+const struct Metadata *meta,
+size_t payload_size,
+int lsb_depth,
+struct StegoWriter *w,
+struct Image *out
+);
+
+int stego_embed_write(struct StegoWriter *w, const unsigned char *data, size_t len);
+
+/* stego_embed_write() with a void* writer, usable as an AesStreamSink */
+int stego_embed_sink(void *writer, const unsigned char *data, size_t len);
+
+int stego_embed_end(struct StegoWriter *w);
+
+/* Returns -10 if the metadata carries a payload checksum that does not
+ * match, -12 for an image holding one shard of a sharded payload and
+ * STEGO_CANCELLED if the job was cancelled while reading. Plain
+ * compressed payloads come back decompressed. For encrypted ones
+ * payload_out holds the ciphertext; decrypt, then decompress_payload()
+ * with meta_out->compression and meta_out->original_size. */
 int stego_extract(
 const struct Image *stego,
 struct Metadata *meta_out,
 struct Payload *payload_out
 );
 
+/* Random access to the embedded payload bytes, e.g. to pull one entry out
+ * of an archive. stego_reader_open() parses the metadata; reads are
+ * bounds-checked against the payload. No checksum is verified, and for
+ * encrypted or compressed payloads the bytes are as stored. */
+struct StegoReader {
+const struct Image *img;
+int lsb_depth;
+size_t payload_bit_pos; /* stream bit of payload byte 0 */
+size_t payload_size;
+};
+
+int stego_reader_open(
+const struct Image *stego,
+struct Metadata *meta_out,
+struct StegoReader *r
+);
+
+int stego_reader_read(const struct StegoReader *r, uint64_t offset, unsigned char *buf, size_t len);
+
+/* Check the payload checksum without extracting: the payload bits are read
+ * and checksummed in small chunks, nothing is allocated for them. Returns
+ * 0 if it matches, -10 on mismatch, -11 if the image has no checksum
+ * (older format), -4 if no metadata is found and STEGO_CANCELLED if the
+ * job was cancelled. meta_out may be NULL. */
+int stego_verify(
+const struct Image *stego,
+struct Metadata *meta_out
+);
+
+/* Read just the metadata of the stego image at path. Only the top rows
+ * that can hold a header are decoded (PNG and BMP; JPEGs are read whole)
+ * and the payload is never touched, so nothing is checksummed. Returns
+ * -3 if the image cannot be loaded and -4 if no metadata is found. */
+int stego_read_metadata(const char *path, struct Metadata *meta_out);
+
+/* The same for an open stream, whose format is told from its content
+ * rather than a file extension. The stream is left open. */
+int stego_read_metadata_stream(FILE *f, struct Metadata *meta_out);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,47 @@
+/* varint.h - Unsigned LEB128 helpers shared by the compact on-image formats
+ * (metadata v2 records and archive indexes). */
+
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VARINT_MAX_LEN 10
+
+/* Write v at p (at most VARINT_MAX_LEN bytes); returns the bytes written. */
+static inline size_t put_varint(unsigned char *p, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/* Read a varint at buf[*offset], advancing *offset. Returns -1 if the
+ * buffer ends first or the value does not fit in 64 bits. */
+static inline int get_varint(const unsigned char *buf, size_t buf_size, size_t *offset, uint64_t *out)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (*offset >= buf_size)
+            return -1;
+        unsigned char b = buf[(*offset)++];
+        if (shift == 63 && b > 1)
+            return -1; /* overflows 64 bits */
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+#endif /* VARINT_H */
@@ -0,0 +1,53 @@
+/* watch.h - Hot-folder mode: encode and decode files dropped in an inbox
+ *
+ * Files are picked up when the writer closes them (or renames them into
+ * the inbox), never while they are still being written, and handed to the
+ * batch.c scheduler, so at most batch_scheduler_set_limits() jobs run at
+ * once. What a file means is told from its content:
+ *
+ *  - a PNG/BMP image carrying a payload is decoded into the outbox;
+ *  - any other PNG/BMP/JPEG image is a cover, and is embedded with the
+ *    payload of the same stem ("report.png" + "report.pdf"), whichever of
+ *    the two arrives last, into <outbox>/<stem>.png;
+ *  - any other file is a payload waiting for that cover.
+ *
+ * Outputs are written under a dot-prefixed temporary name in the outbox
+ * and renamed into place once complete, so a reader of the outbox never
+ * sees a partial file. Inputs are moved to <inbox>/.processed or
+ * <inbox>/.failed once their job ends. Names starting with '.' are
+ * ignored: an uploader can write to ".name" and rename it when done.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct WatchOptions
+    {
+        int lsb_depth;        /* 1..3 */
+        const char *password; /* for encoding and decoding, may be NULL */
+        int cipher;           /* PAYLOAD_CIPHER_*, used with a password */
+    };
+
+    /* Called on the watching thread once per finished job. input names the
+     * file(s) taken from the inbox, output is NULL on failure. */
+    typedef void (*watch_report_fn)(void *ctx, const char *input, const char *output, bool ok, const char *message);
+
+    /* Watch inbox until SIGINT or SIGTERM, then let the running jobs finish
+     * and return 0. Files already in the inbox are picked up first. Returns
+     * -2 if inbox cannot be watched (or stops existing) and -3 if outbox is
+     * not a writable directory, or is inbox or a directory inside it. */
+    int stego_watch(const char *inbox, const char *outbox, const struct WatchOptions *opts, watch_report_fn report,
+                    void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WATCH_H */
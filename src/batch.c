@@ -8,8 +8,18 @@
  *  - aes_encrypt_inplace / aes_decrypt_inplace (aes_wrapper.h)
  *  - stego_embed / stego_extract (stego_core.h)
  *
- * The callbacks (progress and finished) are always invoked on the main thread
- * via g_main_context_invoke() so GUI code can safely manipulate widgets.
+ * The finished callback is always invoked on the main thread via
+ * g_main_context_invoke() so GUI code can safely manipulate widgets.
+ * Progress is not pushed: the worker and the core kernels keep an atomic
+ * counter per task up to date and the GUI samples it on a timer
+ * (batch_task_get_progress()), so a progress update costs one store.
+ *
+ * Tasks do not go straight to a thread: a small scheduler (see "scheduler"
+ * below) queues them and admits one only when a job slot is free and its
+ * estimated peak memory fits the budget, so a batch of hundreds of large
+ * images cannot push the machine into swap. An admitted task then runs as
+ * a pipeline of steps (see "pipeline"), each on the thread pool of its
+ * stage, so I/O, key derivation and compression overlap across jobs.
  */
 
 #include "../include/batch.h"
@@ -18,6 +28,10 @@
 #include "../include/metadata.h"
 #include "../include/aes_wrapper.h"
 #include "../include/stego_core.h"
+#include "../include/compress.h"
+#include "../include/result_cache.h"
+#include "../include/cancel.h"
+#include "../include/progress.h"
 
 #include <glib.h>
 #include <gio/gio.h>
@@ -25,9 +39,26 @@
 #include <string.h>
 #include <stdlib.h>
 #include <libgen.h> // For basename()
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct BatchParams BatchParams;
+
+/* One step of a task's pipeline, run on a worker of its stage. Returns
+ * FALSE to end the task there: with p->err set it failed, otherwise it is
+ * done early (a result cache hit). */
+typedef gboolean (*BatchStepFn)(BatchParams *p, GCancellable *cancellable);
 
-/* Internal struct used to pass parameters to worker */
 typedef struct
+{
+    BatchStage stage;
+    BatchStepFn run; /* NULL ends the list */
+    gboolean (*needed)(const BatchParams *p); /* NULL: always */
+} BatchStep;
+
+/* Internal struct used to pass parameters to worker */
+struct BatchParams
 {
     char *cover_path;
     char *payload_path;
@@ -36,11 +67,34 @@ typedef struct
     char *out_dir;
     char *password;
     int lsb_depth;
-
-    BatchProgressCb progress_cb;
+    int cipher;
+    struct AesBatchKey *batch_key; /* shared key derivation, may be NULL */
+
+    /* Scheduling */
+    const BatchStep *steps; /* encode_steps or decode_steps */
+    guint next_step;
+    BatchPriority priority;
+    guint64 mem_estimate;  /* peak bytes the task is expected to hold */
+
+    /* Handed from one step to the next; only one step runs at a time */
+    const char *err;      /* failure message, static */
+    const char *done_msg; /* success message, static */
+    char *actual_cover_path; /* converted JPEG cover, if any */
+    gboolean cacheable;
+    struct ResultCacheKey cache_key;
+    struct Image in_img;  /* encode: the cover; decode: the stego image */
+    struct Image out_img; /* encode: the stego image */
+    struct Payload payload;
+    struct Metadata meta;
+    struct AesStream *stream; /* encode: keys derived, no sink yet */
+
+    guint progress; /* PROGRESS_ONE units, written by the worker (progress.h) */
     BatchFinishedCb finished_cb;
     gpointer user_data;
-} BatchParams;
+};
+
+/* Shared by every encode task; see batch_set_result_cache() */
+static struct ResultCache *batch_result_cache = NULL;
 
 /* Utility: duplicate string safely (returns malloc'd pointer) */
 static char *dupstr_safe(const char *s)
@@ -50,34 +104,6 @@ static char *dupstr_safe(const char *s)
     return g_strdup(s);
 }
 
-/* Helper: invoke progress callback on main loop with given fraction */
-typedef struct
-{
-    BatchProgressCb cb;
-    gpointer user_data;
-    double fraction;
-} ProgressInvokeData;
-
-static gboolean progress_invoke_cb(gpointer user_data)
-{
-    ProgressInvokeData *d = (ProgressInvokeData *)user_data;
-    if (d->cb)
-        d->cb(d->user_data, d->fraction);
-    g_free(d);
-    return G_SOURCE_REMOVE;
-}
-
-static void report_progress_main(BatchProgressCb cb, gpointer user_data, double fraction)
-{
-    if (!cb)
-        return;
-    ProgressInvokeData *d = g_new0(ProgressInvokeData, 1);
-    d->cb = cb;
-    d->user_data = user_data;
-    d->fraction = fraction;
-    g_main_context_invoke(NULL, progress_invoke_cb, d);
-}
-
 /* Helper: invoke finished callback on main loop with message */
 typedef struct
 {
@@ -108,210 +134,327 @@ static void report_finished_main(BatchFinishedCb cb, gpointer user_data, gboolea
     g_main_context_invoke(NULL, finished_invoke_cb, d);
 }
 
-/* Worker for encode (runs in thread) */
-static void encode_task_func(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+/* Reported for any task stopped by batch_task_cancel() */
+#define BATCH_CANCELLED_MSG "Cancelled"
+
+/* A stage cut short by a cancellation reports that rather than its own
+ * error; the core gives up with STEGO_CANCELLED, which callers further up
+ * may have mapped to a generic failure. */
+static const char *stage_error(GCancellable *cancellable, const char *message)
 {
-    BatchParams *p = (BatchParams *)task_data;
-    (void)source_object;
-    (void)cancellable;
+    return g_cancellable_is_cancelled(cancellable) ? BATCH_CANCELLED_MSG : message;
+}
 
-    char *actual_cover_path = NULL;
-    gboolean jpeg_converted = FALSE;
+static gboolean batch_params_encrypted(const BatchParams *p)
+{
+    return p->batch_key || (p->password && p->password[0] != '\0');
+}
 
-    /* Step 0: Check if cover is JPEG and convert if needed */
+/* Encrypt the payload file straight into the stego image, one
+ * AES_STREAM_CHUNK at a time, so the payload is never fully in memory.
+ * The keys were derived by encode_step_kdf(). Returns NULL on success or
+ * a failure message. */
+static const char *embed_encrypted_file(BatchParams *p)
+{
+    GStatBuf st;
+    if (g_stat(p->payload_path, &st) != 0 || !S_ISREG(st.st_mode))
+        return "Failed to load payload file";
+    size_t enc_size = aes_encrypted_size(p->cipher, (size_t)st.st_size);
+
+    char *payload_path_copy = g_strdup(p->payload_path);
+    const char *payload_basename = basename(payload_path_copy);
+    struct Metadata meta = metadata_create_from_payload(payload_basename, enc_size, p->lsb_depth, true);
+    meta.cipher = (uint8_t)p->cipher;
+    g_free(payload_path_copy);
+
+    struct StegoWriter writer;
+    int rc = stego_embed_begin(&p->in_img, &meta, enc_size, p->lsb_depth, &writer, &p->out_img);
+    metadata_free(&meta);
+    if (rc != 0)
+        return "Embedding failed (maybe insufficient capacity)";
+
+    rc = aes_stream_set_sink(p->stream, stego_embed_sink, &writer);
+    if (rc == 0)
+        rc = aes_stream_update_from_file(p->stream, p->payload_path);
+    if (rc == 0)
+        rc = aes_stream_final(p->stream);
+    aes_stream_free(p->stream);
+    p->stream = NULL;
+    if (rc != 0)
+    {
+        image_free(&p->out_img);
+        return "Encryption failed";
+    }
+    if (stego_embed_end(&writer) != 0)
+        return "Payload file changed while encoding";
+    return NULL;
+}
+
+/* ---------- encode steps ---------- */
+
+static guint64 estimate_encode_memory(const struct Image *cover, guint64 payload_bytes);
+static guint64 estimate_decode_memory(const struct Image *img, const struct Metadata *meta);
+static void scheduler_update_estimate(BatchParams *p, guint64 estimate);
+
+/* Cache lookup, JPEG conversion, cover decode and (unencrypted) payload load */
+static gboolean encode_step_read(BatchParams *p, GCancellable *cancellable)
+{
+    /* Unencrypted jobs are deterministic: unchanged inputs reuse the
+     * cached output instead of decoding, embedding and compressing again */
+    struct ResultCache *cache = batch_result_cache;
+    p->cacheable = cache && !batch_params_encrypted(p);
+    if (p->cacheable)
+    {
+        char *payload_path_copy = g_strdup(p->payload_path);
+        p->cacheable = result_cache_key(p->cover_path, p->payload_path, basename(payload_path_copy),
+                                        p->lsb_depth, PAYLOAD_COMPRESS_NONE, &p->cache_key) == 0;
+        g_free(payload_path_copy);
+        if (p->cacheable && result_cache_fetch(cache, &p->cache_key, p->out_path) == 0)
+        {
+            p->done_msg = "Encode complete (inputs unchanged, reused cached result)";
+            return FALSE;
+        }
+    }
+
+    /* Check if cover is JPEG and convert if needed */
     if (image_is_jpeg(p->cover_path))
     {
-        report_progress_main(p->progress_cb, p->user_data, 0.02);
+        progress_set_stage(0.0, 0.05);
 
         // Generate temporary PNG path
         char temp_png_path[4096];
         snprintf(temp_png_path, sizeof(temp_png_path), "/tmp/stego_batch_converted_%p.png", (void *)p);
 
-        int rc = image_convert_jpeg_to_png(p->cover_path, temp_png_path);
-        if (rc != 0)
+        if (image_convert_jpeg_to_png(p->cover_path, temp_png_path) != 0)
         {
-            report_finished_main(p->finished_cb, p->user_data, FALSE, "Failed to convert JPEG to PNG");
-            return;
+            p->err = stage_error(cancellable, "Failed to convert JPEG to PNG");
+            return FALSE;
         }
+        p->actual_cover_path = g_strdup(temp_png_path);
+    }
 
-        actual_cover_path = g_strdup(temp_png_path);
-        jpeg_converted = TRUE;
+    if (g_cancellable_is_cancelled(cancellable))
+    {
+        p->err = BATCH_CANCELLED_MSG;
+        return FALSE;
     }
-    else
+    progress_set_stage(0.05, 0.30);
+    if (image_load(p->actual_cover_path ? p->actual_cover_path : p->cover_path, &p->in_img) != 0)
     {
-        actual_cover_path = g_strdup(p->cover_path);
+        p->err = stage_error(cancellable, "Failed to load cover image");
+        return FALSE;
     }
 
-    /* Step 1: load cover image */
-    report_progress_main(p->progress_cb, p->user_data, 0.05);
-    struct Image cover = {0};
-    int rc = image_load(actual_cover_path, &cover);
-    if (rc != 0)
+    /* An encrypted payload is streamed from its file by the embed step */
+    if (!batch_params_encrypted(p))
     {
-        if (jpeg_converted)
-            unlink(actual_cover_path);
-        g_free(actual_cover_path);
-        report_finished_main(p->finished_cb, p->user_data, FALSE, "Failed to load cover image");
-        return;
+        progress_set_stage(0.30, 0.35);
+        if (payload_load_from_file(p->payload_path, &p->payload) != 0)
+        {
+            p->err = "Failed to load payload file";
+            return FALSE;
+        }
     }
 
-    /* Step 2: load payload */
-    report_progress_main(p->progress_cb, p->user_data, 0.15);
-    struct Payload payload = {0};
-    rc = payload_load_from_file(p->payload_path, &payload);
+    /* The task was admitted on a guess, see guess_encode_memory() */
+    scheduler_update_estimate(p, estimate_encode_memory(&p->in_img, p->payload.size));
+    return TRUE;
+}
+
+/* PBKDF2 and the encryption header; the ciphertext has nowhere to go yet */
+static gboolean encode_step_kdf(BatchParams *p, GCancellable *cancellable)
+{
+    progress_set_stage(0.30, 0.45);
+    int rc = p->batch_key ? aes_stream_init_with_batch_key(&p->stream, p->cipher, p->batch_key, NULL, NULL)
+                          : aes_stream_init(&p->stream, p->cipher, p->password, NULL, NULL);
     if (rc != 0)
     {
-        image_free(&cover);
-        if (jpeg_converted)
-            unlink(actual_cover_path);
-        g_free(actual_cover_path);
-        report_finished_main(p->finished_cb, p->user_data, FALSE, "Failed to load payload file");
-        return;
+        p->err = stage_error(cancellable, "Encryption failed");
+        return FALSE;
     }
+    return TRUE;
+}
 
-    /* Step 3: optional encryption */
-    if (p->password && p->password[0] != '\0')
+static gboolean encode_step_embed(BatchParams *p, GCancellable *cancellable)
+{
+    const char *err = NULL;
+    if (p->stream)
     {
-        report_progress_main(p->progress_cb, p->user_data, 0.30);
-        rc = aes_encrypt_inplace(&payload, p->password);
-        if (rc != 0)
-        {
-            payload_free(&payload);
-            image_free(&cover);
-            if (jpeg_converted)
-                unlink(actual_cover_path);
-            g_free(actual_cover_path);
-            report_finished_main(p->finished_cb, p->user_data, FALSE, "AES encryption failed");
-            return;
-        }
+        progress_set_stage(0.45, 0.50);
+        err = embed_encrypted_file(p);
+    }
+    else
+    {
+        char *payload_path_copy = g_strdup(p->payload_path);
+        const char *payload_basename = basename(payload_path_copy);
+        p->meta = metadata_create_from_payload(payload_basename, p->payload.size, p->lsb_depth, p->payload.encrypted);
+        g_free(payload_path_copy);
+
+        progress_set_stage(0.35, 0.50);
+        if (stego_embed(&p->in_img, &p->payload, &p->meta, p->lsb_depth, &p->out_img) != 0)
+            err = "Embedding failed (maybe insufficient capacity)";
     }
 
-    /* Step 4: create metadata */
-    report_progress_main(p->progress_cb, p->user_data, 0.45);
-    char *payload_path_copy = g_strdup(p->payload_path);
-    const char *payload_basename = basename(payload_path_copy);
-    struct Metadata meta = metadata_create_from_payload(payload_basename, payload.size, p->lsb_depth, payload.encrypted);
-    g_free(payload_path_copy);
-
-    /* Step 5: embed */
-    report_progress_main(p->progress_cb, p->user_data, 0.60);
-    struct Image outimg = {0};
-    rc = stego_embed(&cover, &payload, &meta, p->lsb_depth, &outimg);
-    if (rc != 0)
+    /* The cover and payload are no longer needed; drop them before the
+     * task waits for the write stage and the PNG encoder allocates its
+     * own buffers */
+    payload_free(&p->payload);
+    image_free(&p->in_img);
+    if (err)
     {
-        metadata_free(&meta);
-        payload_free(&payload);
-        image_free(&cover);
-        if (jpeg_converted)
-            unlink(actual_cover_path);
-        g_free(actual_cover_path);
-        report_finished_main(p->finished_cb, p->user_data, FALSE, "Embedding failed (maybe insufficient capacity)");
-        return;
+        p->err = stage_error(cancellable, err);
+        return FALSE;
     }
+    return TRUE;
+}
 
-    /* Step 6: save PNG */
-    report_progress_main(p->progress_cb, p->user_data, 0.85);
-    rc = image_save(p->out_path, &outimg);
-    if (rc != 0)
+/* PNG encode and write (a failed or cancelled save removes the file) */
+static gboolean encode_step_write(BatchParams *p, GCancellable *cancellable)
+{
+    progress_set_stage(0.50, 1.0);
+    if (image_save(p->out_path, &p->out_img) != 0)
     {
-        image_free(&outimg);
-        metadata_free(&meta);
-        payload_free(&payload);
-        image_free(&cover);
-        if (jpeg_converted)
-            unlink(actual_cover_path);
-        g_free(actual_cover_path);
-        report_finished_main(p->finished_cb, p->user_data, FALSE, "Failed to save output PNG");
-        return;
+        p->err = stage_error(cancellable, "Failed to save output PNG");
+        return FALSE;
     }
+    image_free(&p->out_img);
 
-    /* Cleanup and finish */
-    image_free(&outimg);
-    metadata_free(&meta);
-    payload_free(&payload);
-    image_free(&cover);
+    if (p->cacheable)
+        result_cache_store(batch_result_cache, &p->cache_key, p->out_path); /* best effort */
+    p->done_msg = p->actual_cover_path ? "Encode complete (JPEG auto-converted to PNG)" : "Encode complete";
+    return TRUE;
+}
 
-    // Clean up temporary file
-    if (jpeg_converted)
-        unlink(actual_cover_path);
-    g_free(actual_cover_path);
+static const BatchStep encode_steps[] = {
+    {BATCH_STAGE_READ, encode_step_read, NULL},
+    {BATCH_STAGE_KDF, encode_step_kdf, batch_params_encrypted},
+    {BATCH_STAGE_EMBED, encode_step_embed, NULL},
+    {BATCH_STAGE_WRITE, encode_step_write, NULL},
+    {BATCH_STAGE_READ, NULL, NULL},
+};
 
-    report_progress_main(p->progress_cb, p->user_data, 1.0);
+/* ---------- decode steps ---------- */
 
-    const char *finish_msg = jpeg_converted ? "Encode complete (JPEG auto-converted to PNG)" : "Encode complete";
-    report_finished_main(p->finished_cb, p->user_data, TRUE, finish_msg);
+static gboolean decode_step_read(BatchParams *p, GCancellable *cancellable)
+{
+    progress_set_stage(0.0, 0.45);
+    if (image_load(p->stego_path, &p->in_img) != 0)
+    {
+        p->err = stage_error(cancellable, "Failed to load stego image");
+        return FALSE;
+    }
+
+    /* The task was admitted on a guess, see guess_decode_memory() */
+    struct Metadata meta;
+    struct StegoReader reader;
+    int have_meta = stego_reader_open(&p->in_img, &meta, &reader) == 0;
+    scheduler_update_estimate(p, estimate_decode_memory(&p->in_img, have_meta ? &meta : NULL));
+    return TRUE;
 }
 
-/* Worker for decode (runs in thread) */
-static void decode_task_func(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+static gboolean decode_step_extract(BatchParams *p, GCancellable *cancellable)
 {
-    BatchParams *p = (BatchParams *)task_data;
-    (void)source_object;
     (void)cancellable;
-
-    report_progress_main(p->progress_cb, p->user_data, 0.05);
-    struct Image img = {0};
-    int rc = image_load(p->stego_path, &img);
+    progress_set_stage(0.45, 0.60);
+    int rc = stego_extract(&p->in_img, &p->meta, &p->payload);
+    image_free(&p->in_img); /* everything needed is in payload now */
     if (rc != 0)
     {
-        report_finished_main(p->finished_cb, p->user_data, FALSE, "Failed to load stego image");
-        return;
+        p->err = rc == STEGO_CANCELLED ? BATCH_CANCELLED_MSG
+                 : rc == -10           ? "Payload checksum mismatch (image damaged?)"
+                                       : "Extraction failed (not a stego image?)";
+        return FALSE;
     }
+    if (p->meta.encrypted && (!p->password || p->password[0] == '\0'))
+    {
+        p->err = "Payload is encrypted but no password provided";
+        return FALSE;
+    }
+    return TRUE;
+}
 
-    report_progress_main(p->progress_cb, p->user_data, 0.20);
-    struct Metadata meta = {0};
-    struct Payload payload = {0};
-    rc = stego_extract(&img, &meta, &payload);
+static gboolean decode_is_encrypted(const BatchParams *p)
+{
+    return p->meta.encrypted;
+}
+
+/* PBKDF2, decryption and decompression */
+static gboolean decode_step_decrypt(BatchParams *p, GCancellable *cancellable)
+{
+    (void)cancellable;
+    progress_set_stage(0.60, 0.90);
+    int rc = aes_decrypt_inplace(&p->payload, p->password);
     if (rc != 0)
     {
-        image_free(&img);
-        report_finished_main(p->finished_cb, p->user_data, FALSE, "Extraction failed (not a stego image?)");
-        return;
+        p->err = rc == STEGO_CANCELLED ? BATCH_CANCELLED_MSG
+                 : rc == -9            ? "Payload failed authentication (corrupted?)"
+                                       : "Decryption failed (wrong password?)";
+        return FALSE;
+    }
+    if (p->meta.compression && decompress_payload(&p->payload, p->meta.compression, (size_t)p->meta.original_size) != 0)
+    {
+        p->err = "Decompression failed (corrupted payload?)";
+        return FALSE;
     }
+    return TRUE;
+}
 
-    /* If encrypted, decrypt */
-    if (meta.encrypted)
+/* Write extracted payload to out_dir using original_filename from metadata;
+ * an archive is unpacked into its files instead */
+static gboolean decode_step_write(BatchParams *p, GCancellable *cancellable)
+{
+    (void)cancellable;
+    progress_set_stage(0.90, 1.0);
+    int rc;
+    if (p->meta.archive)
     {
-        if (!p->password || p->password[0] == '\0')
-        {
-            metadata_free(&meta);
-            payload_free(&payload);
-            image_free(&img);
-            report_finished_main(p->finished_cb, p->user_data, FALSE, "Payload is encrypted but no password provided");
-            return;
-        }
-        report_progress_main(p->progress_cb, p->user_data, 0.5);
-        rc = aes_decrypt_inplace(&payload, p->password);
-        if (rc != 0)
+        rc = payload_archive_extract(&p->payload, NULL, p->out_dir);
+    }
+    else
+    {
+        if (!payload_name_ok(p->meta.original_filename, strlen(p->meta.original_filename)))
         {
-            metadata_free(&meta);
-            payload_free(&payload);
-            image_free(&img);
-            report_finished_main(p->finished_cb, p->user_data, FALSE, "AES decryption failed (wrong password?)");
-            return;
+            p->err = "Payload file name is not a plain file name";
+            return FALSE;
         }
+        char outpath[4096];
+        snprintf(outpath, sizeof(outpath), "%s/%s", p->out_dir, p->meta.original_filename);
+        rc = payload_write_to_file(&p->payload, outpath);
     }
-
-    /* Write extracted payload to out_dir using original_filename from metadata */
-    report_progress_main(p->progress_cb, p->user_data, 0.75);
-    char outpath[4096];
-    snprintf(outpath, sizeof(outpath), "%s/%s", p->out_dir, meta.original_filename);
-    rc = payload_write_to_file(&payload, outpath);
     if (rc != 0)
     {
-        metadata_free(&meta);
-        payload_free(&payload);
-        image_free(&img);
-        report_finished_main(p->finished_cb, p->user_data, FALSE, "Failed to write extracted payload to disk");
-        return;
+        p->err = "Failed to write extracted payload to disk";
+        return FALSE;
     }
+    p->done_msg = "Decode complete";
+    return TRUE;
+}
 
-    metadata_free(&meta);
-    payload_free(&payload);
-    image_free(&img);
+static const BatchStep decode_steps[] = {
+    {BATCH_STAGE_READ, decode_step_read, NULL},
+    {BATCH_STAGE_EMBED, decode_step_extract, NULL},
+    {BATCH_STAGE_KDF, decode_step_decrypt, decode_is_encrypted},
+    {BATCH_STAGE_WRITE, decode_step_write, NULL},
+    {BATCH_STAGE_READ, NULL, NULL},
+};
+
+/* Free whatever a task's steps left behind; safe to call more than once */
+static void batch_params_clear_state(BatchParams *p)
+{
+    image_free(&p->in_img);
+    image_free(&p->out_img);
+    payload_free(&p->payload);
+    metadata_free(&p->meta);
+    aes_stream_free(p->stream);
+    p->stream = NULL;
 
-    report_progress_main(p->progress_cb, p->user_data, 1.0);
-    report_finished_main(p->finished_cb, p->user_data, TRUE, "Decode complete");
+    // Clean up temporary file
+    if (p->actual_cover_path)
+    {
+        unlink(p->actual_cover_path);
+        g_free(p->actual_cover_path);
+        p->actual_cover_path = NULL;
+    }
 }
 
 /* Common helper to free BatchParams */
@@ -319,22 +462,314 @@ static void free_batch_params(BatchParams *p)
 {
     if (!p)
         return;
+    batch_params_clear_state(p);
     g_free(p->cover_path);
     g_free(p->payload_path);
     g_free(p->out_path);
     g_free(p->stego_path);
     g_free(p->out_dir);
     g_free(p->password);
+    aes_batch_key_unref(p->batch_key);
     g_free(p);
 }
 
+/* ==========================================================
+ * scheduler
+ *
+ * One FIFO queue per priority. The head of the highest non-empty queue is
+ * always the next task to start, and it starts once fewer than max_jobs
+ * tasks are in the pipeline and its memory estimate fits in what those
+ * leave of the budget. Nothing behind it may overtake it, so large jobs
+ * are not starved by small ones; a job larger than the whole budget runs
+ * alone.
+ * ==========================================================
+ */
+typedef struct
+{
+    GMutex lock;
+    GQueue queued[BATCH_PRIORITY_COUNT]; /* GTask *, one reference each */
+    guint running;      /* admitted to the pipeline, not yet finished */
+    guint64 mem_in_use;
+    guint max_jobs;     /* 0: two per core */
+    guint64 mem_budget; /* 0: half of physical memory */
+} BatchScheduler;
+
+static BatchScheduler scheduler;
+
+#define BATCH_FALLBACK_MEM_BUDGET (1024ull * 1024 * 1024)
+
+/* Twice the workers of a stage, so that every stage can be busy while
+ * other jobs wait in front of the next one */
+static guint scheduler_max_jobs(void)
+{
+    return scheduler.max_jobs ? scheduler.max_jobs : 2 * g_get_num_processors();
+}
+
+static guint64 scheduler_mem_budget(void)
+{
+    if (scheduler.mem_budget)
+        return scheduler.mem_budget;
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0)
+        return BATCH_FALLBACK_MEM_BUDGET;
+    return (guint64)pages * (guint64)page_size / 2;
+}
+
+static void pipeline_advance(GTask *task);
+
+static void scheduler_dispatch(void);
+
+/* Replace the estimate a running task was admitted with */
+static void scheduler_update_estimate(BatchParams *p, guint64 estimate)
+{
+    g_mutex_lock(&scheduler.lock);
+    gboolean shrunk = estimate < p->mem_estimate;
+    scheduler.mem_in_use = scheduler.mem_in_use - p->mem_estimate + estimate;
+    p->mem_estimate = estimate;
+    g_mutex_unlock(&scheduler.lock);
+    if (shrunk)
+        scheduler_dispatch(); /* a queued task may fit now */
+}
+
+/* Start every task that may start now */
+static void scheduler_dispatch(void)
+{
+    GSList *ready = NULL;
+
+    g_mutex_lock(&scheduler.lock);
+    guint max_jobs = scheduler_max_jobs();
+    guint64 budget = scheduler_mem_budget();
+    while (scheduler.running < max_jobs)
+    {
+        GQueue *q = NULL;
+        for (int prio = 0; prio < BATCH_PRIORITY_COUNT && !q; ++prio)
+        {
+            if (!g_queue_is_empty(&scheduler.queued[prio]))
+                q = &scheduler.queued[prio];
+        }
+        if (!q)
+            break;
+
+        BatchParams *p = g_task_get_task_data(g_queue_peek_head(q));
+        if (scheduler.running > 0 && scheduler.mem_in_use + p->mem_estimate > budget)
+            break;
+
+        ready = g_slist_prepend(ready, g_queue_pop_head(q));
+        scheduler.running++;
+        scheduler.mem_in_use += p->mem_estimate;
+    }
+    g_mutex_unlock(&scheduler.lock);
+
+    ready = g_slist_reverse(ready);
+    for (GSList *l = ready; l; l = l->next)
+        pipeline_advance(G_TASK(l->data)); /* takes the queue's reference */
+    g_slist_free(ready);
+}
+
+/* ==========================================================
+ * pipeline
+ *
+ * An admitted task does not hold a thread from start to end. Its steps
+ * (encode_steps, decode_steps) each run on the thread pool of their stage
+ * and the task then moves on to the pool of the next step, so one job's
+ * PBKDF2 overlaps another's PNG decode and a third's PNG encode, and the
+ * throughput of a batch approaches that of its slowest stage rather than
+ * that of all stages in turn. A pool's queue holds only admitted tasks,
+ * so the scheduler's limits bound every queue as well.
+ * ==========================================================
+ */
+typedef struct
+{
+    GMutex lock;
+    GThreadPool *pools[BATCH_STAGE_COUNT]; /* created on first use */
+    guint workers[BATCH_STAGE_COUNT];      /* 0: one per core */
+} BatchPipeline;
+
+static BatchPipeline pipeline;
+
+static guint pipeline_workers(BatchStage stage)
+{
+    return pipeline.workers[stage] ? pipeline.workers[stage] : g_get_num_processors();
+}
+
+static void stage_worker(gpointer data, gpointer user_data);
+
+static GThreadPool *pipeline_pool(BatchStage stage)
+{
+    g_mutex_lock(&pipeline.lock);
+    if (!pipeline.pools[stage])
+        pipeline.pools[stage] = g_thread_pool_new(stage_worker, NULL, (gint)pipeline_workers(stage), FALSE, NULL);
+    GThreadPool *pool = pipeline.pools[stage];
+    g_mutex_unlock(&pipeline.lock);
+    return pool;
+}
+
+/* Report the task, free what its steps left and give its slot back */
+static void pipeline_finish(GTask *task)
+{
+    BatchParams *p = g_task_get_task_data(task);
+    batch_params_clear_state(p);
+    if (p->err)
+    {
+        report_finished_main(p->finished_cb, p->user_data, FALSE, p->err);
+    }
+    else
+    {
+        g_atomic_int_set(&p->progress, PROGRESS_ONE);
+        report_finished_main(p->finished_cb, p->user_data, TRUE, p->done_msg);
+    }
+
+    g_mutex_lock(&scheduler.lock);
+    scheduler.running--;
+    scheduler.mem_in_use -= p->mem_estimate;
+    g_mutex_unlock(&scheduler.lock);
+    g_object_unref(task);
+    scheduler_dispatch();
+}
+
+/* Queue the task on the pool of its next step that applies, or finish it */
+static void pipeline_advance(GTask *task)
+{
+    BatchParams *p = g_task_get_task_data(task);
+    const BatchStep *step = &p->steps[p->next_step];
+    while (step->run && step->needed && !step->needed(p))
+        step = &p->steps[++p->next_step];
+
+    if (step->run)
+        g_thread_pool_push(pipeline_pool(step->stage), task, NULL);
+    else
+        pipeline_finish(task);
+}
+
+static int task_cancel_check(void *cancellable)
+{
+    return g_cancellable_is_cancelled(cancellable);
+}
+
+static void stage_worker(gpointer data, gpointer user_data)
+{
+    GTask *task = data;
+    BatchParams *p = g_task_get_task_data(task);
+    GCancellable *cancellable = g_task_get_cancellable(task);
+    const BatchStep *step = &p->steps[p->next_step++];
+    (void)user_data;
+
+    gboolean more = FALSE;
+    if (g_cancellable_is_cancelled(cancellable))
+    {
+        p->err = BATCH_CANCELLED_MSG;
+    }
+    else
+    {
+        /* The core polls the cancellable and updates the progress counter
+         * between blocks of work (cancel.h, progress.h) */
+        cancel_set_check(task_cancel_check, cancellable);
+        progress_set_sink(&p->progress);
+        more = step->run(p, cancellable);
+        progress_set_sink(NULL);
+        cancel_set_check(NULL, NULL);
+    }
+
+    if (more)
+        pipeline_advance(task);
+    else
+        pipeline_finish(task);
+}
+
+/* Wrap p in a task with its own cancellable and queue it; the caller gets
+ * the returned reference, the queue holds another */
+static GTask *scheduler_submit(BatchParams *p)
+{
+    GCancellable *cancellable = g_cancellable_new();
+    GTask *task = g_task_new(NULL, cancellable, NULL, NULL);
+    g_object_unref(cancellable);
+    g_task_set_task_data(task, p, (GDestroyNotify)free_batch_params);
+
+    g_mutex_lock(&scheduler.lock);
+    g_queue_push_tail(&scheduler.queued[p->priority], g_object_ref(task));
+    g_mutex_unlock(&scheduler.lock);
+    scheduler_dispatch();
+    return task;
+}
+
+/* Estimates saturate here, far above any memory budget, so that sizes
+ * from a corrupted header cannot wrap around and the sum over all running
+ * tasks cannot overflow */
+#define BATCH_MEM_ESTIMATE_MAX (1ull << 48)
+
+static guint64 mem_add(guint64 a, guint64 b)
+{
+    a = MIN(a, BATCH_MEM_ESTIMATE_MAX);
+    return b > BATCH_MEM_ESTIMATE_MAX - a ? BATCH_MEM_ESTIMATE_MAX : a + b;
+}
+
+static guint64 mem_mul(guint64 a, guint64 b)
+{
+    if (a != 0 && b > BATCH_MEM_ESTIMATE_MAX / a)
+        return BATCH_MEM_ESTIMATE_MAX;
+    return a * b;
+}
+
+/* Peak memory of an encode: the decoded cover and the stego copy (both
+ * RGBA after loading), plus the whole payload unless it is encrypted,
+ * which streams through in small chunks. Known once the cover is loaded. */
+static guint64 estimate_encode_memory(const struct Image *cover, guint64 payload_bytes)
+{
+    guint64 est = mem_mul(mem_mul((guint64)cover->width, (guint64)cover->height), 2 * 4);
+    return mem_add(est, payload_bytes);
+}
+
+/* Peak memory of a decode: the image, the extracted payload and its copy,
+ * and the decompressed form if any. Known once the image is loaded. */
+static guint64 estimate_decode_memory(const struct Image *img, const struct Metadata *meta)
+{
+    guint64 est = mem_mul(mem_mul((guint64)img->width, (guint64)img->height), (guint64)img->channels);
+    if (meta)
+    {
+        est = mem_add(est, mem_mul(2, meta->file_size));
+        if (meta->compression)
+            est = mem_add(est, meta->original_size);
+    }
+    return est;
+}
+
+/* A task is admitted on a guess from file sizes alone, so submitting one
+ * never parses an image on the caller's thread (often the GUI's); its
+ * READ step then charges the estimate above instead. A decoded image is
+ * taken to be BATCH_IMAGE_GUESS_FACTOR times its file, which holds for
+ * PNGs and undershoots JPEGs until their READ step. */
+#define BATCH_IMAGE_GUESS_FACTOR 4
+
+static guint64 file_size_or_zero(const char *path)
+{
+    GStatBuf st;
+    return g_stat(path, &st) == 0 ? (guint64)st.st_size : 0;
+}
+
+static guint64 guess_encode_memory(const BatchParams *p)
+{
+    guint64 est = mem_mul(file_size_or_zero(p->cover_path), 2 * BATCH_IMAGE_GUESS_FACTOR);
+    if (!batch_params_encrypted(p))
+        est = mem_add(est, file_size_or_zero(p->payload_path));
+    return est;
+}
+
+/* A stego image's payload is a fraction of its pixels */
+static guint64 guess_decode_memory(const BatchParams *p)
+{
+    return mem_mul(file_size_or_zero(p->stego_path), BATCH_IMAGE_GUESS_FACTOR);
+}
+
 /* Public API: batch_encode_async */
 GTask *batch_encode_async(const char *cover_path,
                           const char *payload_path,
                           const char *out_path,
                           int lsb_depth,
                           const char *password,
-                          BatchProgressCb progress_cb,
+                          int cipher,
+                          struct AesBatchKey *batch_key,
+                          BatchPriority priority,
                           BatchFinishedCb finished_cb,
                           gpointer user_data)
 {
@@ -346,21 +781,22 @@ GTask *batch_encode_async(const char *cover_path,
     p->out_path = dupstr_safe(out_path);
     p->password = dupstr_safe(password);
     p->lsb_depth = lsb_depth;
-    p->progress_cb = progress_cb;
+    p->cipher = cipher;
+    p->batch_key = aes_batch_key_ref(batch_key);
+    p->steps = encode_steps;
+    p->priority = priority;
+    p->mem_estimate = guess_encode_memory(p);
     p->finished_cb = finished_cb;
     p->user_data = user_data;
 
-    GTask *task = g_task_new(NULL, NULL, NULL, NULL);
-    g_task_set_task_data(task, p, (GDestroyNotify)free_batch_params);
-    g_task_run_in_thread(task, encode_task_func);
-    return task;
+    return scheduler_submit(p);
 }
 
 /* Public API: batch_decode_async */
 GTask *batch_decode_async(const char *stego_path,
                           const char *out_dir,
                           const char *password,
-                          BatchProgressCb progress_cb,
+                          BatchPriority priority,
                           BatchFinishedCb finished_cb,
                           gpointer user_data)
 {
@@ -370,28 +806,64 @@ GTask *batch_decode_async(const char *stego_path,
     p->stego_path = dupstr_safe(stego_path);
     p->out_dir = dupstr_safe(out_dir);
     p->password = dupstr_safe(password);
-    p->progress_cb = progress_cb;
+    p->steps = decode_steps;
+    p->priority = priority;
+    p->mem_estimate = guess_decode_memory(p);
     p->finished_cb = finished_cb;
     p->user_data = user_data;
 
-    GTask *task = g_task_new(NULL, NULL, NULL, NULL);
-    g_task_set_task_data(task, p, (GDestroyNotify)free_batch_params);
-    g_task_run_in_thread(task, decode_task_func);
-    return task;
+    return scheduler_submit(p);
+}
+
+void batch_set_result_cache(struct ResultCache *cache)
+{
+    batch_result_cache = cache;
+}
+
+void batch_pipeline_set_workers(BatchStage stage, guint workers)
+{
+    if ((unsigned)stage >= BATCH_STAGE_COUNT)
+        return;
+    g_mutex_lock(&pipeline.lock);
+    pipeline.workers[stage] = workers;
+    if (pipeline.pools[stage])
+        g_thread_pool_set_max_threads(pipeline.pools[stage], (gint)pipeline_workers(stage), NULL);
+    g_mutex_unlock(&pipeline.lock);
+}
+
+void batch_scheduler_set_limits(guint max_jobs, guint64 memory_budget)
+{
+    g_mutex_lock(&scheduler.lock);
+    scheduler.max_jobs = max_jobs;
+    scheduler.mem_budget = memory_budget;
+    g_mutex_unlock(&scheduler.lock);
+    scheduler_dispatch(); /* the limits may have grown */
+}
+
+double batch_task_get_progress(GTask *task)
+{
+    if (!task)
+        return 0.0;
+    BatchParams *p = g_task_get_task_data(task);
+    return (double)(guint)g_atomic_int_get(&p->progress) / PROGRESS_ONE;
 }
 
 void batch_task_cancel(GTask *task)
 {
     if (!task)
         return;
-    GCancellable *c = g_task_get_cancellable(task);
-    if (!c)
-    {
-        /* create a cancellable and set it on the task for future use? just request cancel on a new one */
-        g_cancellable_cancel(g_cancellable_new());
-    }
-    else
-    {
-        g_cancellable_cancel(c);
-    }
+    g_cancellable_cancel(g_task_get_cancellable(task));
+
+    /* A task still in the queue is dropped right away; a running one sees
+     * the cancellable at its next check and reports on its own */
+    BatchParams *p = g_task_get_task_data(task);
+    g_mutex_lock(&scheduler.lock);
+    gboolean dequeued = g_queue_remove(&scheduler.queued[p->priority], task);
+    g_mutex_unlock(&scheduler.lock);
+    if (!dequeued)
+        return;
+
+    report_finished_main(p->finished_cb, p->user_data, FALSE, BATCH_CANCELLED_MSG);
+    g_object_unref(task);
+    scheduler_dispatch(); /* it may have been holding up the queue */
 }
@@ -0,0 +1,22 @@
+/* ==========================================================
+ * cancel.c - Per-thread cancellation checks
+ * ==========================================================
+ */
+
+#include "../include/cancel.h"
+
+#include <stddef.h>
+
+static _Thread_local CancelCheckFn cancel_fn;
+static _Thread_local void *cancel_ctx;
+
+void cancel_set_check(CancelCheckFn fn, void *ctx)
+{
+    cancel_fn = fn;
+    cancel_ctx = fn ? ctx : NULL;
+}
+
+int cancel_requested(void)
+{
+    return cancel_fn && cancel_fn(cancel_ctx);
+}
@@ -0,0 +1,305 @@
+/* ==========================================================
+ * compress.c - Payload compression (zlib and a fast LZ77 codec)
+ * ==========================================================
+ *
+ * The LZ codec uses an LZ4-style block layout: each sequence is a token
+ * byte (literal length in the high nibble, match length - 4 in the low
+ * nibble, 15 meaning "more length bytes follow"), the literals, a 16-bit
+ * little-endian match offset and any extra match length bytes. The last
+ * sequence carries literals only. The decoder checks every bound, since
+ * its input comes from an untrusted image.
+ */
+
+#include "../include/compress.h"
+#include "../include/payload.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/* ---------- LZ codec ---------- */
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5 /* input tail always emitted as literals */
+
+static inline uint32_t lz_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Append a length continuation (the part above 15) */
+static unsigned char *lz_put_length(unsigned char *op, const unsigned char *oend, size_t len)
+{
+    while (len >= 255)
+    {
+        if (op >= oend)
+            return NULL;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend)
+        return NULL;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* Emit one sequence; match_len 0 marks the final literals-only sequence.
+ * Returns the new output position or NULL if out of room. */
+static unsigned char *lz_emit(unsigned char *op, const unsigned char *oend, const unsigned char *lit, size_t lit_len,
+                              size_t offset, size_t match_len)
+{
+    if (op >= oend)
+        return NULL;
+    unsigned char *token = op++;
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    *token = (unsigned char)(((lit_len >= 15 ? 15 : lit_len) << 4) | (ml >= 15 ? 15 : ml));
+
+    if (lit_len >= 15 && !(op = lz_put_length(op, oend, lit_len - 15)))
+        return NULL;
+    if ((size_t)(oend - op) < lit_len)
+        return NULL;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len)
+    {
+        if (oend - op < 2)
+            return NULL;
+        *op++ = (unsigned char)(offset & 0xFF);
+        *op++ = (unsigned char)(offset >> 8);
+        if (ml >= 15 && !(op = lz_put_length(op, oend, ml - 15)))
+            return NULL;
+    }
+    return op;
+}
+
+/* Greedy single-probe compressor. Returns the compressed size, or 0 if it
+ * does not fit in out_cap. */
+static size_t lz_compress(const unsigned char *in, size_t n, unsigned char *out, size_t out_cap)
+{
+    uint32_t *table = calloc((size_t)1 << LZ_HASH_BITS, sizeof(uint32_t)); /* position + 1, 0 = empty */
+    if (!table)
+        return 0;
+
+    unsigned char *op = out;
+    const unsigned char *oend = out + out_cap;
+    size_t anchor = 0;
+    size_t i = 0;
+    size_t limit = n > LZ_LAST_LITERALS + LZ_MIN_MATCH + 4 ? n - (LZ_LAST_LITERALS + LZ_MIN_MATCH + 4) : 0;
+
+    while (i < limit)
+    {
+        uint32_t seq = lz_read32(in + i);
+        uint32_t h = lz_hash(seq);
+        size_t cand = table[h];
+        table[h] = (uint32_t)(i + 1);
+
+        if (cand && i - (cand - 1) <= LZ_MAX_OFFSET && lz_read32(in + cand - 1) == seq)
+        {
+            size_t m = cand - 1;
+            size_t len = LZ_MIN_MATCH;
+            size_t max_len = n - LZ_LAST_LITERALS - i;
+            while (len < max_len && in[m + len] == in[i + len])
+                ++len;
+
+            op = lz_emit(op, oend, in + anchor, i - anchor, i - m, len);
+            if (!op)
+            {
+                free(table);
+                return 0;
+            }
+            i += len;
+            anchor = i;
+        }
+        else
+        {
+            /* Skip faster through data that does not compress */
+            i += 1 + ((i - anchor) >> 6);
+        }
+    }
+
+    op = lz_emit(op, oend, in + anchor, n - anchor, 0, 0);
+    free(table);
+    return op ? (size_t)(op - out) : 0;
+}
+
+static int lz_decompress(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_len)
+{
+    const unsigned char *ip = in;
+    const unsigned char *iend = in + in_len;
+    unsigned char *op = out;
+    unsigned char *oend = out + out_len;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == iend)
+            break; /* final literals-only sequence */
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out))
+            return -1;
+
+        size_t len = (token & 15);
+        if (len == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += LZ_MIN_MATCH;
+        if (len > (size_t)(oend - op))
+            return -1;
+
+        /* Byte copy: source and destination may overlap (runs) */
+        const unsigned char *match = op - offset;
+        if (offset >= len)
+        {
+            memcpy(op, match, len);
+            op += len;
+        }
+        else
+        {
+            for (size_t k = 0; k < len; ++k)
+                *op++ = match[k];
+        }
+    }
+    return op == oend ? 0 : -1;
+}
+
+/* ---------- Public API ---------- */
+
+int compress_payload(struct Payload *payload, int method, int *used_method)
+{
+    if (!payload || !used_method)
+        return -1;
+    *used_method = PAYLOAD_COMPRESS_NONE;
+    if (method == PAYLOAD_COMPRESS_NONE || payload->size == 0)
+        return 0;
+    if (method != PAYLOAD_COMPRESS_ZLIB && method != PAYLOAD_COMPRESS_LZ)
+        return -1;
+
+    /* Only worth it if it saves something; cap the output at size - 1 */
+    size_t cap = payload->size - 1;
+    if (cap == 0)
+        return 0;
+    unsigned char *out = malloc(cap);
+    if (!out)
+        return -2;
+
+    size_t out_len = 0;
+    if (method == PAYLOAD_COMPRESS_ZLIB)
+    {
+        uLongf dest_len = (uLongf)cap;
+        if (compress2(out, &dest_len, payload->data, (uLong)payload->size, Z_DEFAULT_COMPRESSION) == Z_OK)
+            out_len = (size_t)dest_len;
+    }
+    else
+    {
+        out_len = lz_compress(payload->data, payload->size, out, cap);
+    }
+
+    if (out_len == 0)
+    {
+        free(out); /* incompressible: keep the original */
+        return 0;
+    }
+
+    unsigned char *shrunk = realloc(out, out_len);
+    int encrypted = payload->encrypted;
+    payload_free(payload);
+    payload->encrypted = encrypted;
+    payload->data = shrunk ? shrunk : out;
+    payload->size = out_len;
+    *used_method = method;
+    return 0;
+}
+
+int decompress_buffer(int method, const unsigned char *src, size_t src_len, unsigned char *dst, size_t original_size)
+{
+    if (!src || (!dst && original_size))
+        return -1;
+    /* Reject sizes from a corrupted header before allocating for them */
+    if (original_size / COMPRESS_MAX_RATIO > src_len)
+        return -3;
+    switch (method)
+    {
+    case PAYLOAD_COMPRESS_NONE:
+        if (src_len != original_size)
+            return -3;
+        memcpy(dst, src, src_len);
+        return 0;
+    case PAYLOAD_COMPRESS_ZLIB:
+    {
+        uLongf dest_len = (uLongf)original_size;
+        if (uncompress(dst, &dest_len, src, (uLong)src_len) != Z_OK || dest_len != original_size)
+            return -3;
+        return 0;
+    }
+    case PAYLOAD_COMPRESS_LZ:
+        return lz_decompress(src, src_len, dst, original_size) == 0 ? 0 : -3;
+    default:
+        return -2; /* unknown method */
+    }
+}
+
+int decompress_payload(struct Payload *payload, int method, size_t original_size)
+{
+    if (!payload)
+        return -1;
+    if (method == PAYLOAD_COMPRESS_NONE)
+        return 0;
+    if (original_size / COMPRESS_MAX_RATIO > payload->size)
+        return -3;
+
+    unsigned char *out = malloc(original_size ? original_size : 1);
+    if (!out)
+        return -4;
+    int rc = decompress_buffer(method, payload->data, payload->size, out, original_size);
+    if (rc != 0)
+    {
+        free(out);
+        return rc;
+    }
+    payload_free(payload);
+    payload->data = out;
+    payload->size = original_size;
+    return 0;
+}
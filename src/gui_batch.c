@@ -1,6 +1,7 @@
 #include "../include/gui_batch.h"
 #include "../include/batch.h"
 #include "../include/stego_core.h"
+#include "../include/aes_wrapper.h"
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
@@ -18,6 +19,7 @@ typedef struct {
     GtkWidget *payload_stack;           // Encode only: Switch between text/file
     GtkWidget *password_entry;          // Password field
     GtkWidget *lsb_combo;               // Encode only: LSB depth
+    GtkWidget *cipher_combo;            // Encode only: AES / ChaCha20
     GtkWidget *progress_bar;            // Progress indicator
     GtkWidget *status_label;            // Status text
     GtkWidget *remove_button;           // Delete task button
@@ -28,8 +30,10 @@ typedef struct {
     GFile *payload_file;
     gchar *password;
     gint lsb_depth;
+    gint cipher;
     gboolean is_encode;
     gboolean is_processing;
+    gboolean is_cancelling;
     
     // Task execution
     GTask *running_task;                // Reference to running GTask
@@ -40,17 +44,23 @@ typedef struct
 {
     gchar *task_id; /* owned */
     BatchTaskPanel *panel; /* weak reference */
+    gchar *temp_payload_path; /* owned, text payload file removed when the task ends */
 } GuiBatchUserData;
 
 static GtkWidget *task_list_box;          // Container for task panels
 static GtkWidget *start_all_button;       // Button to start all tasks
 static GtkWidget *mode_combo;             // Mode dropdown
+static GtkWidget *shared_kdf_check;       // Derive one key per password for the batch
 static GHashTable *task_panels;           // task_id -> BatchTaskPanel*
 static gint task_counter = 0;             // Counter for generating unique task IDs
+static guint progress_timer_id = 0;       // Polls running tasks' progress, 0 when idle
+
+// Progress bars are refreshed from the tasks' counters at most this often
+#define PROGRESS_POLL_INTERVAL_MS 50
 
 /* Forward declarations */
 static void batch_task_panel_free(BatchTaskPanel *panel);
-static void gui_batch_progress_cb(gpointer user_data, double fraction);
+static gboolean poll_task_progress(gpointer user_data);
 static void gui_batch_finished_cb(gpointer user_data, gboolean success, const char *message);
 static void on_remove_task_clicked(GtkButton *button, gpointer user_data);
 static void update_start_button_sensitivity(void);
@@ -222,8 +232,14 @@ static void on_remove_task_clicked(GtkButton *button, gpointer user_data)
 {
     BatchTaskPanel *panel = (BatchTaskPanel *)user_data;
     
-    // Don't allow removal if task is processing
+    // While processing the button cancels; the panel stays until the task reports back
     if (panel->is_processing) {
+        if (panel->running_task && !panel->is_cancelling) {
+            panel->is_cancelling = TRUE;
+            gtk_widget_set_sensitive(panel->remove_button, FALSE);
+            gtk_label_set_text(GTK_LABEL(panel->status_label), "Cancelling...");
+            batch_task_cancel(panel->running_task);
+        }
         return;
     }
     
@@ -427,6 +443,19 @@ static GtkWidget *create_batch_task_panel(gboolean is_encode)
         gtk_grid_attach(GTK_GRID(grid), label_lsb, 0, row, 1, 1);
         gtk_grid_attach(GTK_GRID(grid), panel->lsb_combo, 1, row, 1, 1);
         row++;
+
+        // Cipher (used when a password is set)
+        GtkWidget *label_cipher = gtk_label_new("Cipher:");
+        gtk_widget_set_halign(label_cipher, GTK_ALIGN_END);
+
+        const char *cipher_options[] = {"AES-256-CBC", "ChaCha20-Poly1305", NULL};
+        GtkStringList *cipher_list = gtk_string_list_new(cipher_options);
+        panel->cipher_combo = gtk_drop_down_new(G_LIST_MODEL(cipher_list), NULL);
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(panel->cipher_combo), 0);
+
+        gtk_grid_attach(GTK_GRID(grid), label_cipher, 0, row, 1, 1);
+        gtk_grid_attach(GTK_GRID(grid), panel->cipher_combo, 1, row, 1, 1);
+        row++;
     }
     
     // Password (both encode and decode)
@@ -475,13 +504,14 @@ static GtkWidget *create_batch_task_panel(gboolean is_encode)
 
 
 /* Start a single task panel */
-static void start_task_panel(BatchTaskPanel *panel)
+static void start_task_panel(BatchTaskPanel *panel, GHashTable *batch_keys)
 {
     // Mark as processing
     panel->is_processing = TRUE;
+    panel->is_cancelling = FALSE;
     
-    // Disable remove button
-    gtk_widget_set_sensitive(panel->remove_button, FALSE);
+    // Remove button cancels the task while it is queued or running
+    gtk_button_set_label(GTK_BUTTON(panel->remove_button), "✕ Cancel");
     
     // Disable input fields
     gtk_widget_set_sensitive(panel->input_chooser, FALSE);
@@ -493,10 +523,11 @@ static void start_task_panel(BatchTaskPanel *panel)
         gtk_widget_set_sensitive(panel->payload_text_view, FALSE);
         gtk_widget_set_sensitive(panel->payload_file_chooser, FALSE);
         gtk_widget_set_sensitive(panel->lsb_combo, FALSE);
+        gtk_widget_set_sensitive(panel->cipher_combo, FALSE);
     }
     
-    // Update status
-    gtk_label_set_text(GTK_LABEL(panel->status_label), panel->is_encode ? "Encoding..." : "Decoding...");
+    // Update status; the first progress report replaces it once the scheduler starts the task
+    gtk_label_set_text(GTK_LABEL(panel->status_label), "Queued...");
     gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(panel->progress_bar), 0.0);
     
     // Get password
@@ -505,6 +536,15 @@ static void start_task_panel(BatchTaskPanel *panel)
     if (password && strlen(password) > 0) {
         panel->password = g_strdup(password);
     }
+
+    // Encode tasks sharing a password share one key derivation if enabled
+    struct AesBatchKey *batch_key = NULL;
+    if (batch_keys && panel->is_encode && panel->password) {
+        batch_key = g_hash_table_lookup(batch_keys, panel->password);
+        if (!batch_key && aes_batch_key_new(&batch_key, panel->password) == 0) {
+            g_hash_table_insert(batch_keys, g_strdup(panel->password), batch_key);
+        }
+    }
     
     // Prepare user data for callbacks
     GuiBatchUserData *ud = g_new0(GuiBatchUserData, 1);
@@ -516,8 +556,8 @@ static void start_task_panel(BatchTaskPanel *panel)
         char *stego_path = g_file_get_path(panel->input_file);
         char *output_dir = g_file_get_path(panel->output_folder);
         
-        panel->running_task = batch_decode_async(stego_path, output_dir, panel->password,
-                                                  gui_batch_progress_cb, gui_batch_finished_cb, ud);
+        panel->running_task = batch_decode_async(stego_path, output_dir, panel->password, BATCH_PRIORITY_NORMAL,
+                                                  gui_batch_finished_cb, ud);
         
         g_free(stego_path);
         g_free(output_dir);
@@ -529,6 +569,9 @@ static void start_task_panel(BatchTaskPanel *panel)
         // Get LSB depth
         guint lsb_selected = gtk_drop_down_get_selected(GTK_DROP_DOWN(panel->lsb_combo));
         panel->lsb_depth = lsb_selected + 1; // 0,1,2 -> 1,2,3
+        panel->cipher = gtk_drop_down_get_selected(GTK_DROP_DOWN(panel->cipher_combo)) == 1
+                            ? PAYLOAD_CIPHER_CHACHA20_POLY1305
+                            : PAYLOAD_CIPHER_AES256_CBC;
         
         // Get payload
         guint payload_type = gtk_drop_down_get_selected(GTK_DROP_DOWN(panel->payload_type_combo));
@@ -565,11 +608,12 @@ static void start_task_panel(BatchTaskPanel *panel)
                 char output_path[1024];
                 snprintf(output_path, sizeof(output_path), "%s/%s", output_dir, output_filename);
                 
+                // Removed by gui_batch_finished_cb once the task is done with it
+                ud->temp_payload_path = g_strdup(temp_path);
                 panel->running_task = batch_encode_async(cover_path, temp_path, output_path, 
-                                                         panel->lsb_depth, panel->password,
-                                                         gui_batch_progress_cb, gui_batch_finished_cb, ud);
+                                                         panel->lsb_depth, panel->password, panel->cipher, batch_key, BATCH_PRIORITY_NORMAL,
+                                                         gui_batch_finished_cb, ud);
                 
-                // Clean up temp file after a delay (will be done in callback)
                 g_free(input_basename);
             }
             
@@ -593,8 +637,8 @@ static void start_task_panel(BatchTaskPanel *panel)
             snprintf(output_path, sizeof(output_path), "%s/%s", output_dir, output_filename);
             
             panel->running_task = batch_encode_async(cover_path, payload_path, output_path,
-                                                     panel->lsb_depth, panel->password,
-                                                     gui_batch_progress_cb, gui_batch_finished_cb, ud);
+                                                     panel->lsb_depth, panel->password, panel->cipher, batch_key, BATCH_PRIORITY_NORMAL,
+                                                     gui_batch_finished_cb, ud);
             
             g_free(payload_path);
             g_free(input_basename);
@@ -612,13 +656,29 @@ static void start_all_tasks(void)
     GHashTableIter iter;
     gpointer key, value;
     g_hash_table_iter_init(&iter, task_panels);
+
+    // password -> AesBatchKey; each task keeps its own reference
+    GHashTable *batch_keys = NULL;
+    if (gtk_check_button_get_active(GTK_CHECK_BUTTON(shared_kdf_check))) {
+        batch_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify)aes_batch_key_unref);
+    }
     
     while (g_hash_table_iter_next(&iter, &key, &value)) {
         BatchTaskPanel *panel = (BatchTaskPanel *)value;
         if (!panel->is_processing && task_panel_is_ready(panel)) {
-            start_task_panel(panel);
+            start_task_panel(panel, batch_keys);
         }
     }
+
+    if (batch_keys) {
+        g_hash_table_destroy(batch_keys);
+    }
+
+    // Sample progress while anything runs; the timer stops itself when all are done
+    if (!progress_timer_id) {
+        progress_timer_id = g_timeout_add(PROGRESS_POLL_INTERVAL_MS, poll_task_progress, NULL);
+    }
     
     // Disable start button while tasks are running
     gtk_widget_set_sensitive(start_all_button, FALSE);
@@ -699,7 +759,13 @@ GtkWidget *gui_batch_create_tab(void)
     start_all_button = gtk_button_new_with_label("Start All Tasks");
     gtk_widget_set_hexpand(start_all_button, TRUE);
     gtk_widget_set_sensitive(start_all_button, FALSE); // Disabled by default
+
+    // Opt-in: one PBKDF2 run per password instead of one per task
+    shared_kdf_check = gtk_check_button_new_with_label("Derive key once for tasks sharing a password");
+    gtk_widget_set_tooltip_text(shared_kdf_check,
+                                "Much faster for large batches; the images then share a key-derivation salt");
     
+    gtk_box_append(GTK_BOX(main_vbox), shared_kdf_check);
     gtk_box_append(GTK_BOX(main_vbox), start_all_button);
 
     // Connect signals
@@ -709,26 +775,40 @@ GtkWidget *gui_batch_create_tab(void)
     return main_vbox;
 }
 
-/* Called on the main thread by batch.c (safe to update GTK widgets directly) */
-static void gui_batch_progress_cb(gpointer user_data, double fraction)
+/* Timer on the main thread: copy each running task's progress counter to its panel */
+static gboolean poll_task_progress(gpointer user_data)
 {
-    GuiBatchUserData *ud = (GuiBatchUserData *)user_data;
-    if (!ud || !ud->task_id || !ud->panel)
-        return;
+    GHashTableIter iter;
+    gpointer key, value;
+    gboolean any_processing = FALSE;
 
-    BatchTaskPanel *panel = ud->panel;
-    
-    // Update progress bar
-    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(panel->progress_bar), fraction);
-    
-    // Update status label
-    if (fraction > 0.0 && fraction < 1.0) {
-        gchar *status_text = g_strdup_printf("%s... %.0f%%", 
-                                             panel->is_encode ? "Encoding" : "Decoding",
-                                             fraction * 100);
-        gtk_label_set_text(GTK_LABEL(panel->status_label), status_text);
-        g_free(status_text);
+    g_hash_table_iter_init(&iter, task_panels);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        BatchTaskPanel *panel = (BatchTaskPanel *)value;
+        if (!panel->is_processing || !panel->running_task)
+            continue;
+        any_processing = TRUE;
+
+        // Keep "Queued..." until the task starts, "Cancelling..." until it stops
+        double fraction = batch_task_get_progress(panel->running_task);
+        if (panel->is_cancelling || fraction <= 0.0)
+            continue;
+
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(panel->progress_bar), fraction);
+        if (fraction < 1.0) {
+            gchar *status_text = g_strdup_printf("%s... %.0f%%",
+                                                 panel->is_encode ? "Encoding" : "Decoding",
+                                                 fraction * 100);
+            gtk_label_set_text(GTK_LABEL(panel->status_label), status_text);
+            g_free(status_text);
+        }
+    }
+
+    if (!any_processing) {
+        progress_timer_id = 0;
+        return G_SOURCE_REMOVE;
     }
+    return G_SOURCE_CONTINUE;
 }
 
 /* Called on the main thread when a task finishes */
@@ -746,6 +826,9 @@ static void gui_batch_finished_cb(gpointer user_data, gboolean success, const ch
     // Update status label with color coding
     if (success) {
         gtk_label_set_markup(GTK_LABEL(panel->status_label), "<span foreground='green'>Complete ✓</span>");
+    } else if (panel->is_cancelling) {
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(panel->progress_bar), 0.0);
+        gtk_label_set_markup(GTK_LABEL(panel->status_label), "<span foreground='orange'>Cancelled</span>");
     } else {
         gchar *error_markup = g_markup_printf_escaped("<span foreground='red'>Failed: %s</span>", 
                                                        message ? message : "Unknown error");
@@ -755,8 +838,14 @@ static void gui_batch_finished_cb(gpointer user_data, gboolean success, const ch
     
     // Mark task as no longer processing
     panel->is_processing = FALSE;
+    panel->is_cancelling = FALSE;
+    if (panel->running_task) {
+        g_object_unref(panel->running_task);
+        panel->running_task = NULL;
+    }
     
-    // Re-enable remove button
+    // Turn the cancel button back into a remove button
+    gtk_button_set_label(GTK_BUTTON(panel->remove_button), "✕ Remove");
     gtk_widget_set_sensitive(panel->remove_button, TRUE);
     
     // Check if all tasks are done, then re-enable start button if there are ready tasks
@@ -765,6 +854,10 @@ static void gui_batch_finished_cb(gpointer user_data, gboolean success, const ch
 cleanup:
     // Free the user_data we allocated when submitting the task
     if (ud) {
+        if (ud->temp_payload_path) {
+            unlink(ud->temp_payload_path);
+            g_free(ud->temp_payload_path);
+        }
         g_free(ud->task_id);
         g_free(ud);
     }
@@ -6,6 +6,7 @@
 #include "../include/image_io.h"
 #include "../include/payload.h"
 #include "../include/metadata.h"
+#include "../include/compress.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -24,6 +25,7 @@ static GtkWidget *encode_file_chooser_input;
 static GtkWidget *encode_file_chooser_output;
 static GtkWidget *encode_entry_password;
 static GtkWidget *encode_combo_lsb_depth;
+static GtkWidget *encode_combo_cipher;
 static GtkWidget *encode_progress_bar;
 static GtkWidget *button_encode;
 static GtkWidget *encode_combo_payload_type;
@@ -43,6 +45,7 @@ static GtkWidget *button_decode;
 static GFile *encode_selected_input_file = NULL;
 static GFile *encode_selected_output_file = NULL;
 static GFile *encode_selected_payload_file = NULL;
+static GListModel *encode_selected_payload_files = NULL; // all selected payload files
 static GFile *decode_selected_input_file = NULL;
 static GFile *decode_selected_output_file = NULL;
 
@@ -186,17 +189,32 @@ static void on_encode_payload_file_selected(GObject *source, GAsyncResult *resul
     GtkFileDialog *dialog = GTK_FILE_DIALOG(source);
     GError *error = NULL;
     
-    GFile *file = gtk_file_dialog_open_finish(dialog, result, &error);
+    GListModel *files = gtk_file_dialog_open_multiple_finish(dialog, result, &error);
     
-    if (file != NULL)
+    if (files != NULL && g_list_model_get_n_items(files) > 0)
     {
         if (encode_selected_payload_file != NULL)
             g_object_unref(encode_selected_payload_file);
+        if (encode_selected_payload_files != NULL)
+            g_object_unref(encode_selected_payload_files);
         
-        encode_selected_payload_file = file;
-        char *basename = g_file_get_basename(file);
-        gtk_button_set_label(GTK_BUTTON(encode_file_chooser_payload), basename);
-        g_free(basename);
+        encode_selected_payload_files = files;
+        encode_selected_payload_file = G_FILE(g_list_model_get_item(files, 0));
+        guint n = g_list_model_get_n_items(files);
+        if (n > 1) {
+            // Several files are embedded together as an archive
+            char *label = g_strdup_printf("%u files", n);
+            gtk_button_set_label(GTK_BUTTON(encode_file_chooser_payload), label);
+            g_free(label);
+        } else {
+            char *basename = g_file_get_basename(encode_selected_payload_file);
+            gtk_button_set_label(GTK_BUTTON(encode_file_chooser_payload), basename);
+            g_free(basename);
+        }
+    }
+    else if (files != NULL)
+    {
+        g_object_unref(files);
     }
     else if (error != NULL && !g_error_matches(error, GTK_DIALOG_ERROR, GTK_DIALOG_ERROR_DISMISSED))
     {
@@ -211,9 +229,9 @@ static void on_encode_payload_file_selected(GObject *source, GAsyncResult *resul
 static void on_encode_payload_chooser_clicked(GtkButton *button, gpointer user_data)
 {
     GtkFileDialog *dialog = gtk_file_dialog_new();
-    gtk_file_dialog_set_title(dialog, "Select Payload File");
+    gtk_file_dialog_set_title(dialog, "Select Payload File(s)");
     
-    gtk_file_dialog_open(dialog, GTK_WINDOW(window), NULL, on_encode_payload_file_selected, NULL);
+    gtk_file_dialog_open_multiple(dialog, GTK_WINDOW(window), NULL, on_encode_payload_file_selected, NULL);
 }
 
 /* Callback: Encode payload type changed */
@@ -317,6 +335,9 @@ static void on_encode_clicked(GtkButton *button, gpointer user_data)
     GtkEntryBuffer *buffer = gtk_entry_get_buffer(GTK_ENTRY(encode_entry_password));
     const gchar *password = gtk_entry_buffer_get_text(buffer);
     gint lsb_depth = gtk_drop_down_get_selected(GTK_DROP_DOWN(encode_combo_lsb_depth)) + 1;
+    int cipher = gtk_drop_down_get_selected(GTK_DROP_DOWN(encode_combo_cipher)) == 1
+                     ? PAYLOAD_CIPHER_CHACHA20_POLY1305
+                     : PAYLOAD_CIPHER_AES256_CBC;
 
     gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(encode_progress_bar), 0.1);
     
@@ -393,6 +414,7 @@ static void on_encode_clicked(GtkButton *button, gpointer user_data)
     // Create payload
     struct Payload payload = {0};
     const char *payload_filename = "message.txt";
+    bool archive = false;
     
     if (payload_type == 0) {
         // Text message
@@ -429,6 +451,33 @@ static void on_encode_clicked(GtkButton *button, gpointer user_data)
             return;
         }
         g_free(text);
+    } else if (encode_selected_payload_files && g_list_model_get_n_items(encode_selected_payload_files) > 1) {
+        // Several files: pack them into one archive payload
+        guint n = g_list_model_get_n_items(encode_selected_payload_files);
+        char **paths = g_new0(char *, n);
+        for (guint i = 0; i < n; i++) {
+            GFile *f = G_FILE(g_list_model_get_item(encode_selected_payload_files, i));
+            paths[i] = g_file_get_path(f);
+            g_object_unref(f);
+        }
+        int rc = payload_archive_build((const char *const *)paths, n, &payload);
+        for (guint i = 0; i < n; i++)
+            g_free(paths[i]);
+        g_free(paths);
+        if (rc != 0) {
+            image_free(&cover);
+            if (jpeg_converted) {
+                unlink(actual_cover_path);
+            }
+            free(actual_cover_path);
+            GtkAlertDialog *dialog = gtk_alert_dialog_new(rc == -7 ? "Two payload files share the same name!" : "Failed to load payload files!");
+            gtk_alert_dialog_show(dialog, GTK_WINDOW(window));
+            g_object_unref(dialog);
+            gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(encode_progress_bar), 0.0);
+            return;
+        }
+        payload_filename = "payload-archive";
+        archive = true;
     } else {
         // File payload
         char *payload_path = g_file_get_path(encode_selected_payload_file);
@@ -455,13 +504,17 @@ static void on_encode_clicked(GtkButton *button, gpointer user_data)
     // Encrypt if password is provided
     bool encrypted = false;
     if (password && strlen(password) > 0) {
-        if (aes_encrypt_inplace(&payload, password) == 0) {
+        if (aes_encrypt_inplace(&payload, cipher, password) == 0) {
             encrypted = true;
         }
     }
     
     // Create metadata
     struct Metadata meta = metadata_create_from_payload(payload_filename, payload.size, lsb_depth, encrypted);
+    if (encrypted) {
+        meta.cipher = (uint8_t)cipher;
+    }
+    meta.archive = archive;
     
     gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(encode_progress_bar), 0.6);
     
@@ -608,6 +661,14 @@ static void on_decode_clicked(GtkButton *button, gpointer user_data)
             gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(decode_progress_bar), 0.0);
             return;
         }
+        if (meta.compression && decompress_payload(&payload, meta.compression, (size_t)meta.original_size) != 0) {
+            payload_free(&payload);
+            GtkAlertDialog *dialog = gtk_alert_dialog_new("Failed to decompress payload! Corrupted data?");
+            gtk_alert_dialog_show(dialog, GTK_WINDOW(window));
+            g_object_unref(dialog);
+            gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(decode_progress_bar), 0.0);
+            return;
+        }
     }
     
     gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(decode_progress_bar), 0.8);
@@ -619,7 +680,14 @@ static void on_decode_clicked(GtkButton *button, gpointer user_data)
     char output_path[1024];
     snprintf(output_path, sizeof(output_path), "%s/%s", output_dir, meta.original_filename);
     
-    if (payload_write_to_file(&payload, output_path) != 0) {
+    int write_rc;
+    if (meta.archive && !payload.encrypted) {
+        // Multi-file payload: unpack every entry into the directory
+        write_rc = payload_archive_extract(&payload, NULL, output_dir);
+    } else {
+        write_rc = payload_write_to_file(&payload, output_path);
+    }
+    if (write_rc != 0) {
         g_free(output_dir);
         payload_free(&payload);
         GtkAlertDialog *dialog = gtk_alert_dialog_new("Failed to save extracted payload!");
@@ -737,6 +805,15 @@ static GtkWidget* create_encode_tab(void)
     encode_combo_lsb_depth = gtk_drop_down_new(G_LIST_MODEL(string_list), NULL);
     gtk_drop_down_set_selected(GTK_DROP_DOWN(encode_combo_lsb_depth), 0);
 
+    // Cipher (used when a password is set)
+    GtkWidget *label_cipher = gtk_label_new("Cipher:");
+    gtk_widget_set_halign(label_cipher, GTK_ALIGN_END);
+
+    const char *cipher_options[] = {"AES-256-CBC", "ChaCha20-Poly1305", NULL};
+    GtkStringList *cipher_list = gtk_string_list_new(cipher_options);
+    encode_combo_cipher = gtk_drop_down_new(G_LIST_MODEL(cipher_list), NULL);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(encode_combo_cipher), 0);
+
     // Progress bar
     encode_progress_bar = gtk_progress_bar_new();
     gtk_widget_set_hexpand(encode_progress_bar, TRUE);
@@ -758,8 +835,10 @@ static GtkWidget* create_encode_tab(void)
     gtk_grid_attach(GTK_GRID(grid), encode_entry_password, 1, 4, 2, 1);
     gtk_grid_attach(GTK_GRID(grid), label_lsb, 0, 5, 1, 1);
     gtk_grid_attach(GTK_GRID(grid), encode_combo_lsb_depth, 1, 5, 1, 1);
-    gtk_grid_attach(GTK_GRID(grid), encode_progress_bar, 0, 6, 3, 1);
-    gtk_grid_attach(GTK_GRID(grid), button_encode, 0, 7, 3, 1);
+    gtk_grid_attach(GTK_GRID(grid), label_cipher, 0, 6, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), encode_combo_cipher, 1, 6, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), encode_progress_bar, 0, 7, 3, 1);
+    gtk_grid_attach(GTK_GRID(grid), button_encode, 0, 8, 3, 1);
 
     // Connect signals
     g_signal_connect(encode_file_chooser_input, "clicked", G_CALLBACK(on_encode_input_chooser_clicked), NULL);
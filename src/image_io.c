@@ -4,14 +4,21 @@
  * Uses libpng and libjpeg for decoding. Only libpng is used
  * for saving to simplify write logic (all stego outputs are
  * saved in PNG format, ensuring lossless results).
+ *
+ * Every codec works on a FILE * and reads or writes it strictly
+ * front to back, so the same code serves files and pipes. The PNG
+ * and BMP readers can stop after the top rows (image_load_head).
  * ==========================================================
  */
 
 #include "../include/image_io.h"
+#include "../include/cancel.h"
+#include "../include/progress.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <setjmp.h>
 #include <png.h>
 #include <jpeglib.h>
 
@@ -22,6 +29,30 @@ static const char *get_ext(const char *path)
     return (dot && dot[1]) ? dot + 1 : "";
 }
 
+/* Helper: rows needed to hold min_bytes of pixel data, all of them if
+ * min_bytes is 0 or the image is smaller */
+static int rows_for(size_t min_bytes, int width, int channels, int height)
+{
+    size_t row = (size_t)width * channels;
+    if (min_bytes == 0 || row == 0)
+        return height;
+    size_t rows = (min_bytes + row - 1) / row;
+    return rows < (size_t)height ? (int)rows : height;
+}
+
+/* Helper: move n bytes forward; seeks where possible, reads on pipes */
+static int skip_bytes(FILE *f, size_t n)
+{
+    if (n == 0 || (n <= 0x7FFFFFFF && fseek(f, (long)n, SEEK_CUR) == 0))
+        return 0;
+    for (; n > 0; --n)
+    {
+        if (fgetc(f) == EOF)
+            return -1;
+    }
+    return 0;
+}
+
 /* ==========================================================
  * BMP loading (simple 24-bit uncompressed reader)
  * ==========================================================
@@ -48,37 +79,33 @@ struct BMPHeader
 };
 #pragma pack(pop)
 
-static int load_bmp(const char *path, struct Image *out)
+/* BMP rows are stored bottom-up, so loading only the top ones skips over
+ * the rest of the file first. */
+static int load_bmp_stream(FILE *f, size_t min_bytes, struct Image *out)
 {
-    FILE *f = fopen(path, "rb");
-    if (!f)
-        return -1;
-
     struct BMPHeader hdr;
     if (fread(&hdr, sizeof(hdr), 1, f) != 1)
-    {
-        fclose(f);
         return -2;
-    }
 
-    if (hdr.bfType != 0x4D42 || hdr.biBitCount != 24 || hdr.biCompression != 0)
-    {
-        fclose(f);
+    if (hdr.bfType != 0x4D42 || hdr.biBitCount != 24 || hdr.biCompression != 0 || hdr.bfOffBits < sizeof(hdr) ||
+        hdr.biWidth <= 0 || hdr.biHeight <= 0)
         return -3; /* unsupported format */
-    }
 
     out->width = hdr.biWidth;
-    out->height = hdr.biHeight;
+    out->height = rows_for(min_bytes, hdr.biWidth, 3, hdr.biHeight);
     out->channels = 3;
     size_t row_padded = ((out->width * 3 + 3) & ~3);
     out->pixels = malloc((size_t)out->width * out->height * 3);
     if (!out->pixels)
-    {
-        fclose(f);
         return -4;
-    }
 
-    fseek(f, hdr.bfOffBits, SEEK_SET);
+    /* skip to the first wanted row; pipes are read through, not seeked */
+    size_t skip = hdr.bfOffBits - sizeof(hdr) + (size_t)(hdr.biHeight - out->height) * row_padded;
+    if (skip_bytes(f, skip) != 0)
+    {
+        image_free(out);
+        return -2;
+    }
 
     for (int y = 0; y < out->height; ++y)
     {
@@ -94,24 +121,52 @@ static int load_bmp(const char *path, struct Image *out)
         }
         free(row);
     }
-    fclose(f);
     return 0;
 }
 
+static int load_bmp(const char *path, size_t min_bytes, struct Image *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    int rc = load_bmp_stream(f, min_bytes, out);
+    fclose(f);
+    return rc;
+}
+
 /* ==========================================================
  * JPEG loading (via libjpeg)
  * ==========================================================
  */
-static int load_jpeg(const char *path, struct Image *out)
+/* libjpeg's default error_exit ends the process. Jump back instead, as
+ * libpng does, so a corrupt JPEG only fails the call that read it. */
+struct jpeg_error_jump
 {
-    FILE *f = fopen(path, "rb");
-    if (!f)
-        return -1;
+    struct jpeg_error_mgr mgr; /* first: cinfo->err points here */
+    jmp_buf env;
+};
+
+static void jpeg_error_exit_jump(j_common_ptr cinfo)
+{
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((struct jpeg_error_jump *)cinfo->err)->env, 1);
+}
 
+static int load_jpeg_stream(FILE *f, struct Image *out)
+{
     struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
+    struct jpeg_error_jump jerr;
 
-    cinfo.err = jpeg_std_error(&jerr);
+    out->pixels = NULL;
+    cinfo.err = jpeg_std_error(&jerr.mgr);
+    jerr.mgr.error_exit = jpeg_error_exit_jump;
+    if (setjmp(jerr.env))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        free(out->pixels);
+        out->pixels = NULL;
+        return -5;
+    }
     jpeg_create_decompress(&cinfo);
     jpeg_stdio_src(&cinfo, f);
     jpeg_read_header(&cinfo, TRUE);
@@ -126,7 +181,6 @@ static int load_jpeg(const char *path, struct Image *out)
     if (!out->pixels)
     {
         jpeg_destroy_decompress(&cinfo);
-        fclose(f);
         return -2;
     }
 
@@ -139,47 +193,45 @@ static int load_jpeg(const char *path, struct Image *out)
 
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
-    fclose(f);
     return 0;
 }
 
+static int load_jpeg(const char *path, struct Image *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    int rc = load_jpeg_stream(f, out);
+    fclose(f);
+    return rc;
+}
+
 /* ==========================================================
  * PNG loading (via libpng)
  * ==========================================================
  */
-static int load_png(const char *path, struct Image *out)
+/* Non-interlaced PNGs are decoded row by row, so only the rows needed for
+ * min_bytes are inflated; an interlaced one has to be decoded whole. */
+static int load_png_stream(FILE *fp, size_t min_bytes, struct Image *out)
 {
-    FILE *fp = fopen(path, "rb");
-    if (!fp)
-        return -1;
-
     unsigned char header[8];
-    fread(header, 1, 8, fp);
-    if (png_sig_cmp(header, 0, 8))
-    {
-        fclose(fp);
+    if (fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8))
         return -2;
-    }
 
     png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr)
-    {
-        fclose(fp);
         return -3;
-    }
 
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr)
     {
         png_destroy_read_struct(&png_ptr, NULL, NULL);
-        fclose(fp);
         return -4;
     }
 
     if (setjmp(png_jmpbuf(png_ptr)))
     {
         png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        fclose(fp);
         return -5;
     }
 
@@ -191,6 +243,7 @@ static int load_png(const char *path, struct Image *out)
     out->height = png_get_image_height(png_ptr, info_ptr);
     png_byte color_type = png_get_color_type(png_ptr, info_ptr);
     png_byte bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    int interlaced = png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE;
 
     if (bit_depth == 16)
         png_set_strip_16(png_ptr);
@@ -213,55 +266,75 @@ static int load_png(const char *path, struct Image *out)
     png_read_update_info(png_ptr, info_ptr);
 
     out->channels = 4; /* RGBA */
+    int rows = interlaced ? out->height : rows_for(min_bytes, out->width, out->channels, out->height);
     size_t rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-    out->pixels = malloc((size_t)rowbytes * out->height);
+    out->pixels = malloc((size_t)rowbytes * rows);
     if (!out->pixels)
     {
         png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        fclose(fp);
         return -6;
     }
 
-    png_bytep *row_pointers = malloc(sizeof(png_bytep) * out->height);
-    for (int y = 0; y < out->height; ++y)
+    png_bytep *row_pointers = malloc(sizeof(png_bytep) * rows);
+    for (int y = 0; y < rows; ++y)
         row_pointers[y] = out->pixels + y * rowbytes;
 
-    png_read_image(png_ptr, row_pointers);
+    if (interlaced)
+    {
+        png_read_image(png_ptr, row_pointers);
+    }
+    else
+    {
+        for (int y = 0; y < rows; ++y)
+        {
+            if (cancel_requested()) /* cheap next to inflating a row */
+            {
+                free(row_pointers);
+                free(out->pixels);
+                out->pixels = NULL;
+                png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+                return STEGO_CANCELLED;
+            }
+            png_read_row(png_ptr, row_pointers[y], NULL);
+            progress_update((uint64_t)y + 1, (uint64_t)rows);
+        }
+    }
     free(row_pointers);
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    fclose(fp);
+    out->height = rows;
     return 0;
 }
 
+static int load_png(const char *path, size_t min_bytes, struct Image *out)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    int rc = load_png_stream(fp, min_bytes, out);
+    fclose(fp);
+    return rc;
+}
+
 /* ==========================================================
  * PNG saving (always saves RGBA or RGB -> PNG)
  * ==========================================================
  */
-static int save_png(const char *path, const struct Image *img)
+static int save_png_stream(FILE *fp, const struct Image *img)
 {
-    FILE *fp = fopen(path, "wb");
-    if (!fp)
-        return -1;
-
     png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr)
-    {
-        fclose(fp);
         return -2;
-    }
 
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr)
     {
         png_destroy_write_struct(&png_ptr, NULL);
-        fclose(fp);
         return -3;
     }
 
     if (setjmp(png_jmpbuf(png_ptr)))
     {
         png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(fp);
         return -4;
     }
 
@@ -276,24 +349,40 @@ static int save_png(const char *path, const struct Image *img)
     png_write_info(png_ptr, info_ptr);
 
     size_t rowbytes = (size_t)img->width * img->channels;
-    png_bytep *row_pointers = malloc(sizeof(png_bytep) * img->height);
     for (int y = 0; y < img->height; ++y)
-        row_pointers[y] = (png_bytep)(img->pixels + y * rowbytes);
-
-    png_write_image(png_ptr, row_pointers);
+    {
+        if (cancel_requested()) /* cheap next to deflating a row */
+        {
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+            return STEGO_CANCELLED;
+        }
+        png_write_row(png_ptr, (png_bytep)(img->pixels + y * rowbytes));
+        progress_update((uint64_t)y + 1, (uint64_t)img->height);
+    }
     png_write_end(png_ptr, NULL);
 
-    free(row_pointers);
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    fclose(fp);
-    return 0;
+    return fflush(fp) == 0 ? 0 : -5;
+}
+
+static int save_png(const char *path, const struct Image *img)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    int rc = save_png_stream(fp, img);
+    if (fclose(fp) != 0 && rc == 0)
+        rc = -5;
+    if (rc != 0)
+        remove(path); /* no truncated PNG left behind */
+    return rc;
 }
 
 /* ==========================================================
  * Public API
  * ==========================================================
  */
-int image_load(const char *path, struct Image *out)
+static int load_by_ext(const char *path, size_t min_bytes, struct Image *out)
 {
     if (!path || !out)
         return -1;
@@ -306,15 +395,115 @@ int image_load(const char *path, struct Image *out)
     lower[sizeof(lower) - 1] = '\0';
 
     if (strstr(lower, "bmp"))
-        return load_bmp(path, out);
+        return load_bmp(path, min_bytes, out);
     if (strstr(lower, "jpg") || strstr(lower, "jpeg"))
         return load_jpeg(path, out);
     if (strstr(lower, "png"))
-        return load_png(path, out);
+        return load_png(path, min_bytes, out);
 
     return -2; /* unsupported extension */
 }
 
+int image_load(const char *path, struct Image *out)
+{
+    return load_by_ext(path, 0, out);
+}
+
+int image_load_head(const char *path, size_t min_bytes, struct Image *out)
+{
+    return load_by_ext(path, min_bytes ? min_bytes : 1, out);
+}
+
+/* Header-only reads behind image_read_info() */
+static int read_bmp_info(FILE *f, int *width, int *height, int *channels)
+{
+    struct BMPHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.bfType != 0x4D42 || hdr.biBitCount != 24)
+        return -3;
+    *width = hdr.biWidth;
+    *height = hdr.biHeight;
+    *channels = 3;
+    return 0;
+}
+
+static int read_jpeg_info(FILE *f, int *width, int *height, int *channels)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_jump jerr;
+
+    cinfo.err = jpeg_std_error(&jerr.mgr);
+    jerr.mgr.error_exit = jpeg_error_exit_jump;
+    if (setjmp(jerr.env))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return -5;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, f);
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_calc_output_dimensions(&cinfo);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    *channels = cinfo.output_components;
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+}
+
+static int read_png_info(FILE *fp, int *width, int *height, int *channels)
+{
+    unsigned char header[8];
+    if (fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8))
+        return -3;
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr)
+        return -4;
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr || setjmp(png_jmpbuf(png_ptr)))
+    {
+        png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : NULL, NULL);
+        return -5;
+    }
+
+    png_init_io(png_ptr, fp);
+    png_set_sig_bytes(png_ptr, 8);
+    png_read_info(png_ptr, info_ptr);
+    *width = png_get_image_width(png_ptr, info_ptr);
+    *height = png_get_image_height(png_ptr, info_ptr);
+    *channels = 4; /* load_png_stream always expands to RGBA */
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    return 0;
+}
+
+int image_read_info(const char *path, int *width, int *height, int *channels)
+{
+    if (!path || !width || !height || !channels)
+        return -1;
+
+    const char *ext = get_ext(path);
+    char lower[8];
+    for (size_t i = 0; i < sizeof(lower) - 1 && ext[i]; ++i)
+        lower[i] = (char)tolower((unsigned char)ext[i]);
+    lower[sizeof(lower) - 1] = '\0';
+
+    int (*info)(FILE *, int *, int *, int *) = NULL;
+    if (strstr(lower, "bmp"))
+        info = read_bmp_info;
+    else if (strstr(lower, "jpg") || strstr(lower, "jpeg"))
+        info = read_jpeg_info;
+    else if (strstr(lower, "png"))
+        info = read_png_info;
+    else
+        return -2; /* unsupported extension */
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    int rc = info(f, width, height, channels);
+    fclose(f);
+    return rc;
+}
+
 int image_save(const char *path, const struct Image *img)
 {
     if (!path || !img)
@@ -322,6 +511,88 @@ int image_save(const char *path, const struct Image *img)
     return save_png(path, img);
 }
 
+/* Formats are told apart by their first byte: 0x89 (PNG), 0xFF (JPEG)
+ * or 'B' (BMP). Peeking one byte is all ungetc() guarantees. */
+static int stream_peek(FILE *f)
+{
+    int c = fgetc(f);
+    if (c != EOF)
+        ungetc(c, f);
+    return c;
+}
+
+/* A piped cover cannot be converted to a PNG file first, so it is widened
+ * to the RGBA layout the PNG reader returns; otherwise the embedded bits
+ * would land on different channels once the stego PNG is read back. */
+static int expand_to_rgba(struct Image *img)
+{
+    if (img->channels == 4)
+        return 0;
+    if (img->channels != 3)
+        return -3;
+
+    size_t count = (size_t)img->width * img->height;
+    unsigned char *rgba = malloc(count * 4);
+    if (!rgba)
+        return -4;
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(rgba + i * 4, img->pixels + i * 3, 3);
+        rgba[i * 4 + 3] = 0xFF;
+    }
+    free(img->pixels);
+    img->pixels = rgba;
+    img->channels = 4;
+    return 0;
+}
+
+static int load_stream(FILE *f, size_t min_bytes, struct Image *out)
+{
+    if (!f || !out)
+        return -1;
+    memset(out, 0, sizeof(*out));
+
+    int rc;
+    switch (stream_peek(f))
+    {
+    case 0x89:
+        return load_png_stream(f, min_bytes, out);
+    case 0xFF:
+        rc = load_jpeg_stream(f, out);
+        break;
+    case 'B':
+        rc = load_bmp_stream(f, min_bytes, out);
+        break;
+    default:
+        return -2; /* unsupported format */
+    }
+    if (rc == 0 && (rc = expand_to_rgba(out)) != 0)
+        image_free(out);
+    return rc;
+}
+
+int image_load_stream(FILE *f, struct Image *out)
+{
+    return load_stream(f, 0, out);
+}
+
+int image_load_head_stream(FILE *f, size_t min_bytes, struct Image *out)
+{
+    return load_stream(f, min_bytes ? min_bytes : 1, out);
+}
+
+int image_save_stream(FILE *f, const struct Image *img)
+{
+    if (!f || !img)
+        return -1;
+    return save_png_stream(f, img);
+}
+
+int image_stream_is_jpeg(FILE *f)
+{
+    return f && stream_peek(f) == 0xFF;
+}
+
 void image_free(struct Image *img)
 {
     if (!img || !img->pixels)
@@ -5,14 +5,24 @@
 #include <gtk/gtk.h>
 #include <unistd.h>
 #include <libgen.h> // For basename()
+#include <sys/stat.h>
+#include <dirent.h>
+#include <time.h>
 
 // Project headers (implemented in later files)
 #include "../include/stego_core.h"  // High-level encode/decode APIs
 #include "../include/image_io.h"    // Image loading/saving
+#include "../include/compress.h"    // Optional payload compression
 #include "../include/aes_wrapper.h" // AES encryption/decryption wrapper
 #include "../include/metadata.h"    // Metadata pack/unpack
 #include "../include/payload.h"     // Payload management
+#include "../include/varint.h"      // Archive index length prefix
+#include "../include/shard.h"       // Payloads split across several covers
+#include "../include/result_cache.h" // Reuse of unchanged encode results
+#include "../include/scan.h"        // Search of directory trees for payloads
 #include "../include/batch.h"       // Batch processing utilities
+#include "../include/manifest.h"    // Job lists for --batch
+#include "../include/watch.h"       // Hot-folder mode for --watch
 #include "../include/gui_main.h"    // Main GUI window
 
 static void print_usage(const char *prog)
@@ -25,10 +35,74 @@ static void print_usage(const char *prog)
         "-------------------------------------------------------------------------------------------------------\n"
         "  -d --decode <stego-image> <output-dir>                   [Mandetory] Extract payload from stego image\n"
         "-------------------------------------------------------------------------------------------------------\n"
+        "  --encode-shards <payload-file> <output-dir> <cover>...   Split the payload across several covers (in parallel);\n"
+        "                                                                      writes <cover>-<i>-of-<n>.png into <output-dir>\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --decode-shards <output-dir> <stego-image>...            Reassemble a split payload from all of its images,\n"
+        "                                                                      in any order (any n-m of them with --parity)\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --parity <m>                                             [Optional] With --encode-shards, make m of the n images\n"
+        "                                                                      Reed-Solomon parity: any n-m images rebuild the payload\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --add <file>                                             [Optional] With --encode, embed this file as well; repeat for\n"
+        "                                                                      more. A directory as <payload-file> embeds its files\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --entry <name>                                           [Optional] With --decode on a multi-file payload, extract\n"
+        "                                                                      only this file\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --verify <stego-image>...                                Check the payload checksum of each image without\n"
+        "                                                                      extracting or writing anything\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --info <stego-image>...                                  Print the metadata of each image; decodes only the\n"
+        "                                                                      rows holding it, never the payload\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --scan <dir>                                             Find the PNG/BMP images under <dir> that carry a payload and\n"
+        "                                                                      print their metadata (in parallel, header rows only)\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --batch <manifest>                                       Run the encode jobs listed in <manifest> ('-': stdin) in parallel\n"
+        "                                                                      and report each; one job per line, as CSV\n"
+        "                                                                      cover,payload,out[,depth[,password_ref]] or JSON objects\n"
+        "                                                                      with those keys. password_ref is env:NAME or file:PATH\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --watch <inbox> <outbox>                                 Until interrupted, decode stego images dropped into <inbox> and\n"
+        "                                                                      embed each payload into the cover of the same name\n"
+        "                                                                      (a.png + a.txt -> <outbox>/a.png), as soon as they\n"
+        "                                                                      are closed; inputs move to <inbox>/.processed or .failed\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --jobs <n>                                               [Optional] With --batch or --watch, run at most n jobs at once\n"
+        "                                                                      (default: two per core)\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --stage-workers <stage=n,...>                            [Optional] With --batch or --watch, worker threads per pipeline\n"
+        "                                                                      stage (read, kdf, embed, write; default: one per core),\n"
+        "                                                                      e.g. kdf=4,write=2\n"
+        "-------------------------------------------------------------------------------------------------------\n"
+        "  --json                                                   [Optional] With --info, --scan, --batch or --watch, print one\n"
+        "                                                                      JSON object per image or job\n"
+        "-------------------------------------------------------------------------------------------------------\n"
         "  -l --lsb <1|2|3>                                         [Mandetory] LSB depth to use (default: 3)\n"
         "-------------------------------------------------------------------------------------------------------\n"
         "  -p --password <password>                                 [Optional] Password to use for AES encryption\n"
         "---------------------------------------------------------------------------------------------------------\n"
+        "  -k --key-file <path>                                     [Optional] Raw AES-256 key (32 bytes or 64 hex digits)\n"
+        "                                                                      instead of a password; skips key derivation\n"
+        "---------------------------------------------------------------------------------------------------------\n"
+        "  --cipher <aes|chacha20>                                  [Optional] Payload cipher when encrypting (default: aes);\n"
+        "                                                                      chacha20 = ChaCha20-Poly1305, fast without AES-NI\n"
+        "---------------------------------------------------------------------------------------------------------\n"
+        "  -z --compress <zlib|lz|none>                             [Optional] Compress the payload before encrypting/embedding;\n"
+        "                                                                      lz is faster, zlib smaller (default: none)\n"
+        "---------------------------------------------------------------------------------------------------------\n"
+        "  --kdf-iterations <n>                                     [Optional] PBKDF2 iterations for new payloads (default: 100000)\n"
+        "---------------------------------------------------------------------------------------------------------\n"
+        "  --calibrate-kdf <ms>                                     [Optional] Pick the PBKDF2 iterations taking <ms> on this\n"
+        "                                                                      machine; prints the count, and uses it with --encode\n"
+        "---------------------------------------------------------------------------------------------------------\n"
+        "  --cache <dir|auto>                                       [Optional] Reuse the output of earlier unencrypted encodes with\n"
+        "                                                                      identical inputs (auto: $STEGO_CACHE_DIR or ~/.cache)\n"
+        "---------------------------------------------------------------------------------------------------------\n"
+        "  --cache-size <MiB>                                       [Optional] Cache size limit; least recently used results are\n"
+        "                                                                      evicted (default: 1024)\n"
+        "---------------------------------------------------------------------------------------------------------\n"
         "  -a --auto-convert                                        [Optional] Automatically convert JPEG to PNG (for encode)\n"
         "---------------------------------------------------------------------------------------------------------\n"
         "  --gui                                                    Launch GTK GUI\n"
@@ -38,16 +112,262 @@ static void print_usage(const char *prog)
         "\n"
         "Note: JPEG is a lossy format and not suitable for steganography as it\n"
         "      corrupts LSB data. Use PNG for reliable results. The --auto-convert\n"
-        "      option will automatically convert JPEG covers to PNG before encoding.\n",
-        prog);
+        "      option will automatically convert JPEG covers to PNG before encoding.\n"
+        "\n"
+        "Pipes: '-' reads the cover or payload of --encode (not both) or the stego\n"
+        "      image of --decode from stdin, and writes the --encode output (PNG) or\n"
+        "      the --decode payload to stdout, e.g. tar c dir | %s -e cover.png - - | ssh ...\n",
+        prog, prog);
+}
+
+/* "-" stands for stdin or stdout wherever the CLI takes a single file */
+#define CLI_STDIN_PAYLOAD_NAME "stdin"
+
+static bool is_stdio_path(const char *path)
+{
+    return path && strcmp(path, "-") == 0;
+}
+
+static int cli_image_load(const char *path, struct Image *img)
+{
+    return is_stdio_path(path) ? image_load_stream(stdin, img) : image_load(path, img);
+}
+
+static int cli_image_save(const char *path, const struct Image *img)
+{
+    return is_stdio_path(path) ? image_save_stream(stdout, img) : image_save(path, img);
+}
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Pack payload_path (a file, or every regular file directly inside a
+ * directory) plus any extra files into an archive payload. */
+static int load_archive_payload(const char *payload_path, char **extra, int extra_count, struct Payload *out)
+{
+    char **paths = NULL;
+    size_t count = 0, cap = 0;
+    int rc = 0;
+
+    struct stat st;
+    if (stat(payload_path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(payload_path);
+        if (!dir)
+            return -2;
+        struct dirent *de;
+        while (rc == 0 && (de = readdir(dir)) != NULL)
+        {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", payload_path, de->d_name);
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            if (count == cap)
+            {
+                cap = cap ? cap * 2 : 16;
+                char **grown = realloc(paths, (cap + (size_t)extra_count) * sizeof(*paths));
+                if (!grown)
+                {
+                    rc = -5;
+                    break;
+                }
+                paths = grown;
+            }
+            if (!(paths[count] = strdup(path)))
+                rc = -5;
+            else
+                ++count;
+        }
+        closedir(dir);
+        /* stable order regardless of directory layout */
+        if (count > 1)
+            qsort(paths, count, sizeof(*paths), compare_paths);
+    }
+    else
+    {
+        paths = malloc((1 + (size_t)extra_count) * sizeof(*paths));
+        if (!paths || !(paths[0] = strdup(payload_path)))
+            rc = -5;
+        else
+            count = 1;
+    }
+    if (rc == 0 && !paths && !(paths = malloc(((size_t)extra_count + 1) * sizeof(*paths))))
+    {
+        rc = -5;
+    }
+    for (int i = 0; rc == 0 && i < extra_count; ++i)
+    {
+        if (!(paths[count] = strdup(extra[i])))
+            rc = -5;
+        else
+            ++count;
+    }
+
+    if (rc == 0 && count == 0)
+    {
+        fprintf(stderr, "Error: No files to embed in '%s'\n", payload_path);
+        rc = -2;
+    }
+    if (rc == 0)
+    {
+        rc = payload_archive_build((const char *const *)paths, count, out);
+        if (rc == -7)
+            fprintf(stderr, "Error: Two payload files share the same name\n");
+        else if (rc)
+            fprintf(stderr, "Error: Failed to pack payload files into an archive\n");
+        else
+            fprintf(stderr, "Packed %lu files into an archive payload\n", (unsigned long)count);
+    }
+    for (size_t i = 0; i < count; ++i)
+        free(paths[i]);
+    free(paths);
+    return rc;
+}
+
+/* Encrypt the payload file straight into the stego image one
+ * AES_STREAM_CHUNK at a time, so the payload is never fully in memory. */
+static int embed_encrypted_file(
+    const struct Image *cover,
+    const char *payload_path,
+    int lsb_depth,
+    const char *password,
+    const unsigned char *key,
+    int cipher,
+    struct Image *out)
+{
+    struct stat st;
+    if (stat(payload_path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "Error: Failed to load payload file '%s'\n", payload_path);
+        return -2;
+    }
+    size_t enc_size = aes_encrypted_size(cipher, (size_t)st.st_size);
+
+    // Use basename of payload_path for metadata
+    char *payload_path_copy = strdup(payload_path);
+    const char *payload_basename = basename(payload_path_copy);
+    struct Metadata meta = metadata_create_from_payload(payload_basename, enc_size, lsb_depth, true);
+    meta.cipher = (uint8_t)cipher;
+    free(payload_path_copy);
+
+    struct StegoWriter writer;
+    int rc = stego_embed_begin(cover, &meta, enc_size, lsb_depth, &writer, out);
+    metadata_free(&meta);
+    if (rc)
+    {
+        fprintf(stderr, "Error: Failed to embed payload into cover image\n");
+        return rc;
+    }
+
+    if (key)
+        rc = aes_stream_encrypt_file_with_key(payload_path, cipher, key, stego_embed_sink, &writer);
+    else
+        rc = aes_stream_encrypt_file(payload_path, cipher, password, stego_embed_sink, &writer);
+    if (rc)
+    {
+        fprintf(stderr, "Error: Failed to encrypt payload\n");
+        image_free(out);
+        return rc;
+    }
+
+    rc = stego_embed_end(&writer);
+    if (rc)
+    {
+        fprintf(stderr, "Error: Payload file '%s' changed while encoding\n", payload_path);
+    }
+    return rc;
+}
+
+/* Load the payload (a file, or several packed into an archive), then
+ * compress and encrypt it as requested and fill in its metadata. Used by
+ * every encode path that needs the whole payload in memory. */
+static int prepare_payload(
+    const char *payload_path,
+    char **extra_files,
+    int extra_count,
+    bool archive,
+    const char *password,
+    const unsigned char *key,
+    int cipher,
+    int compression,
+    int lsb_depth,
+    struct Payload *payload,
+    struct Metadata *meta)
+{
+    bool encrypt = key || (password && strlen(password) > 0);
+    int rc = 0;
+
+    if (archive)
+    {
+        rc = load_archive_payload(payload_path, extra_files, extra_count, payload);
+    }
+    else
+    {
+        rc = is_stdio_path(payload_path) ? payload_load_from_fd(STDIN_FILENO, payload)
+                                         : payload_load_from_file(payload_path, payload);
+        if (rc)
+        {
+            fprintf(stderr, "Error: Failed to load payload file '%s'\n", payload_path);
+        }
+    }
+    if (rc)
+    {
+        return rc;
+    }
+
+    /* Compression has to see the plaintext, so this path works on the
+     * whole payload in memory: load -> compress -> encrypt -> embed */
+    size_t original_size = payload->size;
+    int used_compression = PAYLOAD_COMPRESS_NONE;
+    if (compression != PAYLOAD_COMPRESS_NONE)
+    {
+        rc = compress_payload(payload, compression, &used_compression);
+        if (rc == 0 && used_compression != PAYLOAD_COMPRESS_NONE)
+        {
+            fprintf(stderr, "Compressed payload: %lu -> %lu bytes\n",
+                    (unsigned long)original_size, (unsigned long)payload->size);
+        }
+    }
+    if (rc == 0 && encrypt)
+    {
+        rc = key ? aes_encrypt_with_key(payload, cipher, key) : aes_encrypt_inplace(payload, cipher, password);
+    }
+    if (rc)
+    {
+        fprintf(stderr, "Error: Failed to %s payload\n", encrypt ? "compress/encrypt" : "compress");
+        payload_free(payload);
+        return rc;
+    }
+
+    // Use basename of payload_path for metadata
+    char *payload_path_copy = strdup(payload_path);
+    const char *payload_basename = is_stdio_path(payload_path) ? CLI_STDIN_PAYLOAD_NAME : basename(payload_path_copy);
+    *meta = metadata_create_from_payload(payload_basename, payload->size, lsb_depth, encrypt);
+    free(payload_path_copy);
+    if (encrypt)
+    {
+        meta->cipher = (uint8_t)cipher;
+    }
+    meta->compression = (uint8_t)used_compression;
+    meta->original_size = original_size;
+    meta->archive = archive;
+    return 0;
 }
+
 static int cli_encode(
     const char *cover_path,
     const char *payload_path,
     const char *out_path,
     int lsb_depth,
     const char *password,
-    bool auto_convert)
+    const unsigned char *key,
+    int cipher,
+    int compression,
+    char **extra_files,
+    int extra_count,
+    bool auto_convert,
+    struct ResultCache *cache)
 {
     struct Payload payload = {0};
     struct Image cover = {0};
@@ -56,8 +376,45 @@ static int cli_encode(
     char *actual_cover_path = NULL;
     bool converted = false;
 
-    // Check if cover is JPEG
-    if (image_is_jpeg(cover_path))
+    if (is_stdio_path(cover_path) && is_stdio_path(payload_path))
+    {
+        fprintf(stderr, "Error: Only one of the cover and the payload can come from stdin\n");
+        return -1;
+    }
+
+    bool encrypt = key || (password && strlen(password) > 0);
+    struct stat payload_st;
+    bool archive = extra_count > 0 || (stat(payload_path, &payload_st) == 0 && S_ISDIR(payload_st.st_mode));
+
+    // Unencrypted single-file encodes are deterministic, so a cached
+    // result for identical inputs can stand in for the whole job
+    struct ResultCacheKey cache_key;
+    bool cacheable = cache && !encrypt && !archive && !is_stdio_path(cover_path) &&
+                     !is_stdio_path(payload_path) && !is_stdio_path(out_path) &&
+                     (auto_convert || !image_is_jpeg(cover_path));
+    if (cacheable)
+    {
+        char *payload_path_copy = strdup(payload_path);
+        cacheable = payload_path_copy &&
+                    result_cache_key(cover_path, payload_path, basename(payload_path_copy),
+                                     lsb_depth, compression, &cache_key) == 0;
+        free(payload_path_copy);
+        if (cacheable && result_cache_fetch(cache, &cache_key, out_path) == 0)
+        {
+            fprintf(stderr, "Inputs unchanged: reused cached result for '%s'\n", out_path);
+            return 0;
+        }
+    }
+
+    // Check if cover is JPEG (a piped cover is only peeked at)
+    bool cover_is_jpeg = is_stdio_path(cover_path) ? image_stream_is_jpeg(stdin) : image_is_jpeg(cover_path);
+    if (cover_is_jpeg && auto_convert && is_stdio_path(cover_path))
+    {
+        // No file to convert: the JPEG is decoded straight from the pipe
+        fprintf(stderr, "Warning: Cover image is JPEG format; decoding it from stdin.\n");
+        actual_cover_path = strdup(cover_path);
+    }
+    else if (cover_is_jpeg)
     {
         fprintf(stderr, "Warning: Cover image is JPEG format.\n");
         fprintf(stderr, "JPEG is a lossy format and not suitable for steganography.\n");
@@ -94,7 +451,7 @@ static int cli_encode(
         actual_cover_path = strdup(cover_path);
     }
 
-    rc = image_load(actual_cover_path, &cover);
+    rc = cli_image_load(actual_cover_path, &cover);
     if (rc)
     {
         fprintf(stderr, "Error: Failed to load cover image '%s'\n", actual_cover_path);
@@ -106,26 +463,29 @@ static int cli_encode(
         return rc;
     }
 
-    rc = payload_load_from_file(payload_path, &payload);
-    if (rc)
+    if (encrypt && compression == PAYLOAD_COMPRESS_NONE && !archive && !is_stdio_path(payload_path))
     {
-        fprintf(stderr, "Error: Failed to load payload file '%s'\n", payload_path);
-        image_free(&cover);
-        if (converted)
+        /* Encrypted payloads are streamed file -> AES -> embed; a piped
+         * payload's size is unknown up front, so it goes the other way */
+        rc = embed_encrypted_file(&cover, payload_path, lsb_depth, password, key, cipher, &out);
+        if (rc)
         {
-            unlink(actual_cover_path);
+            image_free(&cover);
+            if (converted)
+            {
+                unlink(actual_cover_path);
+            }
+            free(actual_cover_path);
+            return rc;
         }
-        free(actual_cover_path);
-        return rc;
     }
-
-    if (password && strlen(password) > 0)
+    else
     {
-        rc = aes_encrypt_inplace(&payload, password);
+        struct Metadata meta;
+        rc = prepare_payload(payload_path, extra_files, extra_count, archive, password, key,
+                             cipher, compression, lsb_depth, &payload, &meta);
         if (rc)
         {
-            fprintf(stderr, "Error: Failed to encrypt payload with AES\n");
-            payload_free(&payload);
             image_free(&cover);
             if (converted)
             {
@@ -134,35 +494,29 @@ static int cli_encode(
             free(actual_cover_path);
             return rc;
         }
-    }
-
-    // Use basename of payload_path for metadata
-    char *payload_path_copy = strdup(payload_path);
-    const char *payload_basename = basename(payload_path_copy);
-    struct Metadata meta = metadata_create_from_payload(payload_basename, payload.size, lsb_depth, (password && strlen(password) > 0));
-    free(payload_path_copy);
 
-    rc = stego_embed(
-        &cover,
-        &payload,
-        &meta,
-        lsb_depth,
-        &out);
-    if (rc)
-    {
-        fprintf(stderr, "Error: Failed to embed payload into cover image\n");
+        rc = stego_embed(
+            &cover,
+            &payload,
+            &meta,
+            lsb_depth,
+            &out);
         metadata_free(&meta);
         payload_free(&payload);
-        image_free(&cover);
-        if (converted)
+        if (rc)
         {
-            unlink(actual_cover_path);
+            fprintf(stderr, "Error: Failed to embed payload into cover image\n");
+            image_free(&cover);
+            if (converted)
+            {
+                unlink(actual_cover_path);
+            }
+            free(actual_cover_path);
+            return rc;
         }
-        free(actual_cover_path);
-        return rc;
     }
 
-    rc = image_save(out_path, &out);
+    rc = cli_image_save(out_path, &out);
     if (rc)
     {
         fprintf(stderr, "Error: Failed to save stego image to '%s'\n", out_path);
@@ -171,9 +525,11 @@ static int cli_encode(
     {
         fprintf(stderr, "Successfully encoded using auto-converted PNG cover.\n");
     }
+    if (rc == 0 && cacheable)
+    {
+        result_cache_store(cache, &cache_key, out_path); // best effort
+    }
 
-    metadata_free(&meta);
-    payload_free(&payload);
     image_free(&cover);
     image_free(&out);
 
@@ -186,49 +542,157 @@ static int cli_encode(
 
     return rc;
 }
-static int cli_decode(
-    const char *stego_path,
-    const char *out_dir,
-    const char *password)
+/* Pull one entry out of a plain archive payload, reading only the index
+ * and that entry's bytes from the image. Returns 1 if the payload is not
+ * stored plainly (encrypted or compressed) and needs a full extract. */
+static int extract_archive_entry(const struct Image *img, const char *entry, const char *out_dir)
 {
-    struct Image img = {0};
     struct Metadata meta = {0};
-    struct Payload payload = {0};
-    int rc = 0; // Return code
-
-    rc = image_load(stego_path, &img);
+    struct StegoReader reader;
+    int rc = stego_reader_open(img, &meta, &reader);
     if (rc)
     {
-        fprintf(stderr, "Error: Failed to load stego image '%s'\n", stego_path);
+        fprintf(stderr, "Error: Failed to extract (maybe not a stego image)\n");
         return rc;
     }
+    if (!meta.archive)
+    {
+        fprintf(stderr, "Error: Payload is a single file, not an archive\n");
+        return -1;
+    }
+    if (meta.encrypted || meta.compression || meta.sharded)
+    {
+        return 1;
+    }
 
-    rc = stego_extract(&img, &meta, &payload);
+    unsigned char head[VARINT_MAX_LEN];
+    size_t head_len = reader.payload_size < sizeof(head) ? reader.payload_size : sizeof(head);
+    size_t index_len = 0;
+    unsigned char *index = NULL;
+    struct PayloadArchive archive = {0};
+    rc = stego_reader_read(&reader, 0, head, head_len);
+    if (rc == 0)
+        rc = payload_archive_header_len(head, head_len, &index_len);
+    if (rc == 0 && index_len > reader.payload_size)
+        rc = -3;
+    if (rc == 0 && !(index = malloc(index_len)))
+        rc = -5;
+    if (rc == 0)
+        rc = stego_reader_read(&reader, 0, index, index_len);
+    if (rc == 0)
+        rc = payload_archive_open(index, index_len, reader.payload_size, &archive);
+    free(index);
     if (rc)
     {
-        fprintf(stderr, "Error: Failed to extract (maybe not a stego image)\n");
-        image_free(&img);
+        fprintf(stderr, "Error: Archive index is damaged\n");
         return rc;
     }
-    fprintf(stderr, "[DEBUG] Decoded metadata: original filename='%s', size=%lu, lsb_depth=%d, encrypted=%d\n",
-            meta.original_filename,
-            (unsigned long)meta.file_size,
-            meta.lsb_depth,
-            meta.encrypted);
 
-    fprintf(stderr, "Extracted payload size: %lu bytes\n", (unsigned long)payload.size);
+    const struct PayloadArchiveEntry *e = payload_archive_find(&archive, entry);
+    if (!e)
+    {
+        fprintf(stderr, "Error: No entry named '%s' in the archive\n", entry);
+        payload_archive_free(&archive);
+        return -8;
+    }
+    unsigned char *body = malloc(e->size ? (size_t)e->size : 1);
+    rc = body ? stego_reader_read(&reader, archive.bodies_offset + e->offset, body, (size_t)e->size) : -5;
+    if (rc == 0 && is_stdio_path(out_dir))
+    {
+        struct Payload entry_payload = {body, (size_t)e->size, 0, 0};
+        rc = payload_write_to_fd(&entry_payload, STDOUT_FILENO);
+    }
+    else if (rc == 0)
+        rc = payload_archive_write_entry(e, body, out_dir);
+    if (rc)
+        fprintf(stderr, "Error: Failed to save '%s' to '%s'\n", entry, out_dir);
+    else
+        fprintf(stderr, "Extracted '%s' (%lu bytes)\n", e->name, (unsigned long)e->size);
+    free(body);
+    payload_archive_free(&archive);
+    return rc;
+}
+
+/* Decrypt, decompress and write out an extracted payload: a single file
+ * goes to out_dir under its original name, an archive is unpacked (only
+ * entry, if given). Frees meta and payload. */
+static int save_decoded_payload(
+    struct Metadata *meta,
+    struct Payload *payload,
+    const char *out_dir,
+    const char *password,
+    const unsigned char *key,
+    const char *entry)
+{
+    int rc = 0;
+
+    fprintf(stderr, "Extracted payload size: %lu bytes\n", (unsigned long)payload->size);
 
-    if (meta.encrypted && password && strlen(password) > 0)
+    if (meta->encrypted && (key || (password && strlen(password) > 0)))
     {
-        rc = aes_decrypt_inplace(&payload, password);
+        rc = key ? aes_decrypt_with_key(payload, key) : aes_decrypt_inplace(payload, password);
         if (rc)
         {
-            fprintf(stderr, "Error: Failed to decrypt payload with AES (maybe wrong password)\n");
-            metadata_free(&meta);
-            payload_free(&payload);
-            image_free(&img);
+            if (rc == -9)
+                fprintf(stderr, "Error: Payload failed authentication (corrupted or tampered with)\n");
+            else
+                fprintf(stderr, "Error: Failed to decrypt payload (maybe wrong %s)\n", key ? "key" : "password");
+            metadata_free(meta);
+            payload_free(payload);
             return rc;
         }
+        if (meta->compression)
+        {
+            rc = decompress_payload(payload, meta->compression, (size_t)meta->original_size);
+            if (rc)
+            {
+                fprintf(stderr, "Error: Failed to decompress payload (corrupted data)\n");
+                metadata_free(meta);
+                payload_free(payload);
+                return rc;
+            }
+        }
+    }
+
+    if (meta->archive && !payload->encrypted && is_stdio_path(out_dir))
+    {
+        // stdout takes one file: the requested entry
+        struct PayloadArchive archive = {0};
+        const struct PayloadArchiveEntry *e = NULL;
+        if (!entry)
+        {
+            fprintf(stderr, "Error: Payload is a multi-file archive; use --entry <name> to write one file to stdout\n");
+            rc = -1;
+        }
+        else if ((rc = payload_archive_open(payload->data, payload->size, payload->size, &archive)) != 0)
+            fprintf(stderr, "Error: Archive index is damaged\n");
+        else if (!(e = payload_archive_find(&archive, entry)))
+        {
+            fprintf(stderr, "Error: No entry named '%s' in the archive\n", entry);
+            rc = -8;
+        }
+        else
+        {
+            struct Payload body = {payload->data + archive.bodies_offset + e->offset, (size_t)e->size, 0, 0};
+            rc = payload_write_to_fd(&body, STDOUT_FILENO);
+            if (rc)
+                fprintf(stderr, "Error: Failed to write '%s' to stdout\n", entry);
+        }
+        payload_archive_free(&archive);
+        metadata_free(meta);
+        payload_free(payload);
+        return rc;
+    }
+    if (meta->archive && !payload->encrypted)
+    {
+        rc = payload_archive_extract(payload, entry, out_dir);
+        if (rc == -8)
+            fprintf(stderr, "Error: No entry named '%s' in the archive\n", entry);
+        else if (rc)
+            fprintf(stderr, "Error: Failed to unpack archive into '%s'\n", out_dir);
+        metadata_free(meta);
+        payload_free(payload);
+        return rc;
     }
 
     // Save extracted payload using original filename from metadata
@@ -238,30 +702,539 @@ static int cli_decode(
         sizeof(out_path),
         "%s/%s",
         out_dir,
-        meta.original_filename);
-    rc = payload_write_to_file(&payload, out_path);
+        meta->original_filename);
+    rc = is_stdio_path(out_dir) ? payload_write_to_fd(payload, STDOUT_FILENO) : payload_write_to_file(payload, out_path);
     if (rc)
     {
-        fprintf(stderr, "Error: Failed to save extracted payload to '%s'\n", out_path);
+        fprintf(stderr, "Error: Failed to save extracted payload to '%s'\n", is_stdio_path(out_dir) ? "stdout" : out_path);
     }
 
-    metadata_free(&meta);
-    payload_free(&payload);
-    image_free(&img);
+    metadata_free(meta);
+    payload_free(payload);
     return rc;
 }
-static void launch_gui(int argc, char **argv)
-{
-    gui_init(&argc, &argv);
-    gui_show_main_window();
-}
 
-int main(int argc, char **argv)
+static int cli_decode(
+    const char *stego_path,
+    const char *out_dir,
+    const char *password,
+    const unsigned char *key,
+    const char *entry)
 {
-    if (argc < 2)
+    struct Image img = {0};
+    struct Metadata meta = {0};
+    struct Payload payload = {0};
+    int rc = 0; // Return code
+
+    rc = cli_image_load(stego_path, &img);
+    if (rc)
     {
-        print_usage(argv[0]);
-        return 1;
+        fprintf(stderr, "Error: Failed to load stego image '%s'\n", stego_path);
+        return rc;
+    }
+
+    if (entry)
+    {
+        rc = extract_archive_entry(&img, entry, out_dir);
+        if (rc <= 0)
+        {
+            image_free(&img);
+            return rc;
+        }
+        /* encrypted/compressed archive: fall through to a full extract */
+    }
+
+    rc = stego_extract(&img, &meta, &payload);
+    if (rc == -10)
+    {
+        fprintf(stderr, "Error: Payload checksum mismatch (image damaged or modified)\n");
+        image_free(&img);
+        return rc;
+    }
+    if (rc == -12)
+    {
+        fprintf(stderr, "Error: Image holds shard %u of %u of a larger payload; use --decode-shards with all of them\n",
+                (unsigned)meta.shard_index + 1, (unsigned)meta.shard_count);
+        image_free(&img);
+        return rc;
+    }
+    if (rc)
+    {
+        fprintf(stderr, "Error: Failed to extract (maybe not a stego image)\n");
+        image_free(&img);
+        return rc;
+    }
+    image_free(&img);
+    return save_decoded_payload(&meta, &payload, out_dir, password, key, entry);
+}
+/* Split one payload across several covers, written to out_dir as
+ * <cover>-<i>-of-<n>.png. With parity_count > 0 that many of the images
+ * are parity, and any cover_count - parity_count of them decode. */
+static int cli_encode_shards(
+    const char *payload_path,
+    const char *out_dir,
+    char **covers,
+    int cover_count,
+    int parity_count,
+    int lsb_depth,
+    const char *password,
+    const unsigned char *key,
+    int cipher,
+    int compression,
+    char **extra_files,
+    int extra_count)
+{
+    if (parity_count > 0 && (parity_count >= cover_count || cover_count > METADATA_MAX_CODED_SHARDS))
+    {
+        fprintf(stderr, "Error: --parity needs fewer parity images than covers, and at most %d covers\n",
+                METADATA_MAX_CODED_SHARDS);
+        return -1;
+    }
+
+    struct stat st;
+    bool archive = extra_count > 0 || (stat(payload_path, &st) == 0 && S_ISDIR(st.st_mode));
+    struct Payload payload = {0};
+    struct Metadata meta;
+    int rc = prepare_payload(payload_path, extra_files, extra_count, archive, password, key,
+                             cipher, compression, lsb_depth, &payload, &meta);
+    if (rc)
+    {
+        return rc;
+    }
+
+    size_t data_shards = (size_t)(cover_count - parity_count);
+    rc = shard_encode_files((const char *const *)covers, (size_t)cover_count, data_shards,
+                            &payload, &meta, lsb_depth, out_dir);
+    if (rc == -5)
+        fprintf(stderr, "Error: Payload (%lu bytes) does not fit in the given covers at LSB depth %d\n",
+                (unsigned long)payload.size, lsb_depth);
+    else if (rc == -2)
+        fprintf(stderr, "Error: Failed to load one of the cover images\n");
+    else if (rc)
+        fprintf(stderr, "Error: Failed to embed or save the shards\n");
+    else
+        fprintf(stderr, "Embedded %lu bytes across %d covers into '%s'\n",
+                (unsigned long)payload.size, cover_count, out_dir);
+    metadata_free(&meta);
+    payload_free(&payload);
+    return rc;
+}
+
+/* Reassemble a sharded payload from its images, given in any order. */
+static int cli_decode_shards(
+    const char *out_dir,
+    char **stegos,
+    int stego_count,
+    const char *password,
+    const unsigned char *key,
+    const char *entry)
+{
+    struct Metadata meta = {0};
+    struct Payload payload = {0};
+    int rc = shard_decode_files((const char *const *)stegos, (size_t)stego_count, &meta, &payload);
+    if (rc)
+    {
+        if (rc == -3)
+            fprintf(stderr, "Error: The images are not one complete set of shards (or too few of a parity set)\n");
+        else if (rc == -10)
+            fprintf(stderr, "Error: A shard failed its checksum (image damaged or modified)\n");
+        else if (rc == -2)
+            fprintf(stderr, "Error: Failed to load one of the stego images\n");
+        else
+            fprintf(stderr, "Error: Failed to extract (maybe not stego images)\n");
+        return rc;
+    }
+    return save_decoded_payload(&meta, &payload, out_dir, password, key, entry);
+}
+
+/* Checksum the payload of each image without extracting it. Prints one
+ * line per image; returns 0 only if every image verified. */
+static int cli_verify(char **paths, int count)
+{
+    int failed = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        struct Image img = {0};
+        if (image_load(paths[i], &img) != 0)
+        {
+            printf("ERROR   %s (cannot load image)\n", paths[i]);
+            ++failed;
+            continue;
+        }
+
+        struct Metadata meta = {0};
+        int rc = stego_verify(&img, &meta);
+        image_free(&img);
+        switch (rc)
+        {
+        case 0:
+            printf("OK      %s (%s, %lu bytes)\n", paths[i], meta.original_filename, (unsigned long)meta.file_size);
+            break;
+        case -10:
+            printf("BAD     %s (checksum mismatch)\n", paths[i]);
+            ++failed;
+            break;
+        case -11:
+            printf("NOCRC   %s (written without a checksum)\n", paths[i]);
+            ++failed;
+            break;
+        default:
+            printf("ERROR   %s (no payload found)\n", paths[i]);
+            ++failed;
+            break;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+static const char *cipher_name(const struct Metadata *meta)
+{
+    if (!meta->encrypted)
+        return "none";
+    return meta->cipher == PAYLOAD_CIPHER_CHACHA20_POLY1305 ? "chacha20" : "aes";
+}
+
+static const char *compression_name(const struct Metadata *meta)
+{
+    switch (meta->compression)
+    {
+    case PAYLOAD_COMPRESS_ZLIB:
+        return "zlib";
+    case PAYLOAD_COMPRESS_LZ:
+        return "lz";
+    default:
+        return "none";
+    }
+}
+
+/* JSON string literal; control characters are \u-escaped */
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (const unsigned char *p = (const unsigned char *)s; *p; ++p)
+    {
+        if (*p == '"' || *p == '\\')
+            printf("\\%c", *p);
+        else if (*p < 0x20)
+            printf("\\u%04x", *p);
+        else
+            putchar(*p);
+    }
+    putchar('"');
+}
+
+/* One text line or one JSON object per image */
+static void print_metadata(const char *image, const struct Metadata *meta, bool json)
+{
+    if (json)
+    {
+        printf("{\"image\": ");
+        print_json_string(image);
+        printf(", \"filename\": ");
+        print_json_string(meta->original_filename);
+        printf(", \"size\": %llu, \"lsb_depth\": %d, \"encrypted\": %s, \"cipher\": \"%s\", "
+               "\"compression\": \"%s\", \"original_size\": %llu, \"version\": %u, \"checksum\": %s, "
+               "\"archive\": %s",
+               (unsigned long long)meta->file_size, meta->lsb_depth, meta->encrypted ? "true" : "false",
+               cipher_name(meta), compression_name(meta),
+               (unsigned long long)(meta->compression ? meta->original_size : meta->file_size),
+               (unsigned)meta->version, meta->has_crc ? "true" : "false", meta->archive ? "true" : "false");
+        if (meta->sharded)
+        {
+            printf(", \"shard\": {\"index\": %u, \"count\": %u, \"data_shards\": %u, \"total_size\": %llu}",
+                   (unsigned)meta->shard_index, (unsigned)meta->shard_count, (unsigned)meta->data_shards,
+                   (unsigned long long)meta->total_size);
+        }
+        printf("}\n");
+        return;
+    }
+
+    printf("%s: '%s', %llu bytes, lsb_depth=%d, encrypted=%s, cipher=%s, compression=%s",
+           image, meta->original_filename, (unsigned long long)meta->file_size, meta->lsb_depth,
+           meta->encrypted ? "yes" : "no", cipher_name(meta), compression_name(meta));
+    if (meta->compression)
+        printf(" (%llu bytes)", (unsigned long long)meta->original_size);
+    if (meta->archive)
+        printf(", archive");
+    if (meta->sharded)
+        printf(", shard %u of %u", (unsigned)meta->shard_index + 1, (unsigned)meta->shard_count);
+    if (meta->sharded && meta->data_shards < meta->shard_count)
+        printf(" (%u data)", (unsigned)meta->data_shards);
+    printf(", checksum=%s\n", meta->has_crc ? "yes" : "no");
+}
+
+/* Print the metadata of each image, read without touching the payload.
+ * Returns 0 only if every image held metadata. */
+static int cli_info(char **paths, int count, bool json)
+{
+    int failed = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        struct Metadata meta = {0};
+        int rc = stego_read_metadata(paths[i], &meta);
+        if (rc == 0)
+        {
+            print_metadata(paths[i], &meta, json);
+            continue;
+        }
+
+        const char *why = rc == -3 ? "cannot load image" : "no payload found";
+        if (json)
+        {
+            printf("{\"image\": ");
+            print_json_string(paths[i]);
+            printf(", \"error\": \"%s\"}\n", why);
+        }
+        else
+        {
+            printf("ERROR   %s (%s)\n", paths[i], why);
+        }
+        ++failed;
+    }
+    return failed ? 1 : 0;
+}
+
+static void print_scan_hit(void *ctx, const char *path, const struct Metadata *meta)
+{
+    print_metadata(path, meta, *(const bool *)ctx);
+}
+
+/* Report every image under dir that carries a payload; a summary goes to
+ * stderr. Returns 0 if the whole tree could be read. */
+static int cli_scan(const char *dir, bool json)
+{
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    struct ScanStats stats;
+    int rc = stego_scan_dir(dir, 0, print_scan_hit, &json, &stats);
+    if (rc != 0)
+    {
+        fprintf(stderr, "Error: Cannot scan directory '%s'\n", dir);
+        return rc;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "Scanned %llu files (%llu images) in %.2f s, %.0f files/s: %llu carry a payload",
+            (unsigned long long)stats.files, (unsigned long long)stats.images, secs,
+            secs > 0 ? (double)stats.files / secs : 0.0, (unsigned long long)stats.hits);
+    if (stats.errors)
+        fprintf(stderr, ", %llu unreadable", (unsigned long long)stats.errors);
+    fprintf(stderr, "\n");
+    return stats.errors ? 1 : 0;
+}
+
+/* State of --batch, shared by the finished callbacks of its jobs */
+struct BatchRun
+{
+    bool json;
+    size_t pending; /* submitted jobs not yet reported */
+    size_t failed;
+};
+
+struct BatchJobState
+{
+    const struct ManifestJob *job;
+    struct BatchRun *run;
+};
+
+/* One report line or JSON object per job, in completion order */
+static void report_batch_job(struct BatchJobState *st, bool ok, const char *message)
+{
+    if (st->run->json)
+    {
+        printf("{\"line\": %u, \"out\": ", st->job->line);
+        print_json_string(st->job->out);
+        printf(", \"ok\": %s, \"message\": ", ok ? "true" : "false");
+        print_json_string(message ? message : "");
+        printf("}\n");
+    }
+    else
+    {
+        printf("%-8s%s (line %u: %s)\n", ok ? "OK" : "FAILED", st->job->out, st->job->line, message ? message : "");
+    }
+    fflush(stdout); /* a reader following the report sees each job as it ends */
+    if (!ok)
+        st->run->failed++;
+}
+
+/* Runs on this thread, from the context iterated by cli_batch() */
+static void batch_job_finished(gpointer user_data, gboolean success, const char *message)
+{
+    struct BatchJobState *st = user_data;
+    report_batch_job(st, success, message);
+    st->run->pending--;
+}
+
+/* Parse the stage=count list of --stage-workers into workers[], leaving
+ * the stages it does not name at 0 (the default). Returns -1 on an
+ * unknown stage or a count below 1. */
+static int parse_stage_workers(const char *spec, unsigned workers[BATCH_STAGE_COUNT])
+{
+    static const char *const names[BATCH_STAGE_COUNT] = {"read", "kdf", "embed", "write"};
+    if (!*spec)
+        return -1;
+    while (*spec)
+    {
+        const char *eq = strchr(spec, '=');
+        if (!eq)
+            return -1;
+        int stage = -1;
+        for (int k = 0; k < BATCH_STAGE_COUNT; ++k)
+        {
+            if (strlen(names[k]) == (size_t)(eq - spec) && strncmp(spec, names[k], (size_t)(eq - spec)) == 0)
+                stage = k;
+        }
+        char *end;
+        long n = strtol(eq + 1, &end, 10);
+        if (stage < 0 || end == eq + 1 || n < 1 || n > 1024 || (*end != ',' && *end != '\0'))
+            return -1;
+        workers[stage] = (unsigned)n;
+        spec = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+/* Encode every job of a manifest on the batch.c workers, at most jobs at a
+ * time (0: two per core). Finished jobs are delivered through GLib's
+ * default main context, iterated here; no GTK main loop is involved.
+ * Jobs without a password_ref use password, if any. Returns 0 if every
+ * job succeeded. */
+static int cli_batch(const char *manifest_path, int default_depth, const char *password, int cipher,
+                     unsigned jobs, bool json)
+{
+    struct Manifest manifest;
+    unsigned bad_line = 0;
+    int rc = manifest_load(manifest_path, &manifest, &bad_line);
+    if (rc == -3)
+    {
+        fprintf(stderr, "Error: Malformed job on line %u of manifest '%s'\n", bad_line, manifest_path);
+        return 1;
+    }
+    if (rc != 0)
+    {
+        fprintf(stderr, "Error: Cannot read manifest '%s'\n", manifest_path);
+        return 1;
+    }
+    if (manifest.count == 0)
+    {
+        fprintf(stderr, "Error: Manifest '%s' lists no jobs\n", manifest_path);
+        return 1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    struct BatchRun run = {json, 0, 0};
+    struct BatchJobState *states = calloc(manifest.count, sizeof(*states));
+    GTask **tasks = calloc(manifest.count, sizeof(*tasks));
+    if (!states || !tasks)
+    {
+        free(states);
+        free(tasks);
+        manifest_free(&manifest);
+        return 1;
+    }
+
+    batch_scheduler_set_limits(jobs, 0);
+    for (size_t i = 0; i < manifest.count; ++i)
+    {
+        const struct ManifestJob *job = &manifest.jobs[i];
+        states[i].job = job;
+        states[i].run = &run;
+
+        char *job_password = NULL;
+        if (job->password_ref && manifest_resolve_password(job->password_ref, &job_password) != 0)
+        {
+            report_batch_job(&states[i], false, "Cannot resolve password reference");
+            continue;
+        }
+
+        tasks[i] = batch_encode_async(job->cover, job->payload, job->out, job->lsb_depth ? job->lsb_depth : default_depth,
+                                      job_password ? job_password : password, cipher, NULL, BATCH_PRIORITY_NORMAL,
+                                      batch_job_finished, &states[i]);
+        if (job_password)
+        {
+            memset(job_password, 0, strlen(job_password));
+            free(job_password);
+        }
+        if (tasks[i])
+            run.pending++;
+        else
+            report_batch_job(&states[i], false, "Invalid job");
+    }
+
+    while (run.pending > 0)
+        g_main_context_iteration(NULL, TRUE);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "Ran %zu jobs in %.2f s (%.2f jobs/s): %zu succeeded, %zu failed\n", manifest.count, secs,
+            secs > 0 ? (double)manifest.count / secs : 0.0, manifest.count - run.failed, run.failed);
+
+    for (size_t i = 0; i < manifest.count; ++i)
+    {
+        if (tasks[i])
+            g_object_unref(tasks[i]);
+    }
+    free(tasks);
+    free(states);
+    manifest_free(&manifest);
+    return run.failed ? 1 : 0;
+}
+
+static void report_watch_job(void *ctx, const char *input, const char *output, bool ok, const char *message)
+{
+    bool json = *(const bool *)ctx;
+    if (json)
+    {
+        printf("{\"input\": ");
+        print_json_string(input);
+        printf(", \"out\": ");
+        if (output)
+            print_json_string(output);
+        else
+            printf("null");
+        printf(", \"ok\": %s, \"message\": ", ok ? "true" : "false");
+        print_json_string(message ? message : "");
+        printf("}\n");
+    }
+    else
+    {
+        printf("%-8s%s -> %s (%s)\n", ok ? "OK" : "FAILED", input, output ? output : "-", message ? message : "");
+    }
+    fflush(stdout);
+}
+
+/* Serve the hot folder until SIGINT/SIGTERM, with at most jobs jobs at a
+ * time (0: two per core) */
+static int cli_watch(const char *inbox, const char *outbox, int lsb_depth, const char *password, int cipher,
+                     unsigned jobs, bool json)
+{
+    struct WatchOptions opts = {lsb_depth, password, cipher};
+    batch_scheduler_set_limits(jobs, 0);
+    fprintf(stderr, "Watching '%s', writing to '%s' (Ctrl-C to stop)\n", inbox, outbox);
+    int rc = stego_watch(inbox, outbox, &opts, report_watch_job, &json);
+    if (rc == -3)
+        fprintf(stderr, "Error: '%s' is not a writable directory outside the inbox\n", outbox);
+    else if (rc != 0)
+        fprintf(stderr, "Error: Cannot watch '%s'\n", inbox);
+    return rc == 0 ? 0 : 1;
+}
+
+static void launch_gui(int argc, char **argv)
+{
+    gui_init(&argc, &argv);
+    gui_show_main_window();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        print_usage(argv[0]);
+        return 1;
     }
 
     /* Basic CLI parsing (not comprehensive) */
@@ -272,10 +1245,36 @@ int main(int argc, char **argv)
     const char *stego = NULL;
     const char *outdir = NULL;
     const char *password = NULL;
+    const char *key_file = NULL;
+    long kdf_iterations = 0;
+    long calibrate_ms = 0;
+    int cipher = PAYLOAD_CIPHER_AES256_CBC;
+    int compression = PAYLOAD_COMPRESS_NONE;
     int lsb_depth = 3;
     bool do_encode = false;
     bool do_decode = false;
+    char **verify_paths = NULL;
+    int verify_count = 0;
+    char **info_paths = NULL;
+    int info_count = 0;
+    bool json = false;
+    const char *scan_dir = NULL;
+    const char *batch_manifest = NULL;
+    const char *watch_inbox = NULL;
+    const char *watch_outbox = NULL;
+    long batch_jobs = 0;
+    unsigned stage_workers[BATCH_STAGE_COUNT] = {0};
+    char **extra_files = NULL;
+    int extra_count = 0;
+    const char *entry = NULL;
+    char **shard_paths = NULL;
+    int shard_count = 0;
+    int parity_count = 0;
+    bool do_encode_shards = false;
+    bool do_decode_shards = false;
     bool auto_convert = false;
+    const char *cache_dir = NULL;
+    uint64_t cache_size = RESULT_CACHE_DEFAULT_MAX_BYTES;
 
     for (int i = 1; i < argc; ++i)
     {
@@ -302,6 +1301,192 @@ int main(int argc, char **argv)
             stego = argv[++i];
             outdir = argv[++i];
         }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            /* Takes every following argument up to the next option */
+            verify_paths = &argv[i + 1];
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                ++verify_count;
+                ++i;
+            }
+            if (verify_count == 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--info") == 0)
+        {
+            /* Same argument rule as --verify */
+            info_paths = &argv[i + 1];
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                ++info_count;
+                ++i;
+            }
+            if (info_count == 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--scan") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            scan_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--batch") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            batch_manifest = argv[++i];
+        }
+        else if (strcmp(argv[i], "--watch") == 0)
+        {
+            if (i + 2 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            watch_inbox = argv[++i];
+            watch_outbox = argv[++i];
+        }
+        else if (strcmp(argv[i], "--jobs") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            batch_jobs = atol(argv[++i]);
+            if (batch_jobs < 1)
+            {
+                fprintf(stderr, "Error: invalid job count (must be at least 1)\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--stage-workers") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (parse_stage_workers(argv[++i], stage_workers) != 0)
+            {
+                fprintf(stderr, "Error: invalid --stage-workers (stage=n,... with stages read, kdf, embed, write)\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else if (strcmp(argv[i], "--encode-shards") == 0 || strcmp(argv[i], "--decode-shards") == 0)
+        {
+            /* --encode-shards <payload> <out-dir> <cover>...
+             * --decode-shards <out-dir> <stego>... */
+            bool enc = strcmp(argv[i], "--encode-shards") == 0;
+            int fixed = enc ? 2 : 1;
+            if (i + fixed >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (enc)
+            {
+                do_encode_shards = true;
+                payload = argv[++i];
+            }
+            else
+            {
+                do_decode_shards = true;
+            }
+            outdir = argv[++i];
+            shard_paths = &argv[i + 1];
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                ++shard_count;
+                ++i;
+            }
+            if (shard_count == 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cache") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            long mib = atol(argv[++i]);
+            if (mib < 1)
+            {
+                fprintf(stderr, "Error: invalid cache size (MiB, at least 1)\n");
+                return 1;
+            }
+            cache_size = (uint64_t)mib * 1024 * 1024;
+        }
+        else if (strcmp(argv[i], "--add") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            /* argv outlives the parse, so keep pointers into it */
+            char **grown = realloc(extra_files, (size_t)(extra_count + 1) * sizeof(*extra_files));
+            if (!grown)
+            {
+                free(extra_files);
+                return 1;
+            }
+            extra_files = grown;
+            extra_files[extra_count++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--entry") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            entry = argv[++i];
+        }
+        else if (strcmp(argv[i], "--parity") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            parity_count = atoi(argv[++i]);
+            if (parity_count < 1)
+            {
+                fprintf(stderr, "Error: invalid parity count (must be at least 1)\n");
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--lsb") == 0)
         {
             if (i + 1 >= argc)
@@ -325,6 +1510,91 @@ int main(int argc, char **argv)
             }
             password = argv[++i];
         }
+        else if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--key-file") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            key_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cipher") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            const char *name = argv[++i];
+            if (strcmp(name, "aes") == 0)
+            {
+                cipher = PAYLOAD_CIPHER_AES256_CBC;
+            }
+            else if (strcmp(name, "chacha20") == 0)
+            {
+                cipher = PAYLOAD_CIPHER_CHACHA20_POLY1305;
+            }
+            else
+            {
+                fprintf(stderr, "Error: unknown cipher '%s' (use aes or chacha20)\n", name);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-z") == 0 || strcmp(argv[i], "--compress") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            const char *name = argv[++i];
+            if (strcmp(name, "zlib") == 0)
+            {
+                compression = PAYLOAD_COMPRESS_ZLIB;
+            }
+            else if (strcmp(name, "lz") == 0)
+            {
+                compression = PAYLOAD_COMPRESS_LZ;
+            }
+            else if (strcmp(name, "none") == 0)
+            {
+                compression = PAYLOAD_COMPRESS_NONE;
+            }
+            else
+            {
+                fprintf(stderr, "Error: unknown compression '%s' (use zlib, lz or none)\n", name);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--kdf-iterations") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            kdf_iterations = atol(argv[++i]);
+            if (kdf_iterations < 1000 || kdf_iterations > 50000000)
+            {
+                fprintf(stderr, "Error: invalid KDF iteration count (must be 1000..50000000)\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--calibrate-kdf") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            calibrate_ms = atol(argv[++i]);
+            if (calibrate_ms < 1 || calibrate_ms > 60000)
+            {
+                fprintf(stderr, "Error: invalid calibration target (must be 1..60000 ms)\n");
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--auto-convert") == 0)
         {
             auto_convert = true;
@@ -346,22 +1616,127 @@ int main(int argc, char **argv)
         }
     }
 
+    for (int k = 0; k < BATCH_STAGE_COUNT; ++k)
+    {
+        if (stage_workers[k])
+            batch_pipeline_set_workers((BatchStage)k, stage_workers[k]);
+    }
+
+    struct ResultCache *cache = NULL;
+    if (cache_dir)
+    {
+        char default_dir[4096];
+        if (strcmp(cache_dir, "auto") == 0)
+        {
+            cache_dir = result_cache_default_dir(default_dir, sizeof(default_dir)) == 0 ? default_dir : NULL;
+        }
+        if (!cache_dir || result_cache_open(cache_dir, cache_size, &cache) != 0)
+        {
+            fprintf(stderr, "Warning: Cannot open the result cache; encoding without it\n");
+            cache = NULL;
+        }
+        batch_set_result_cache(cache);
+    }
+
     if (use_gui)
     {
         launch_gui(argc, argv);
+        batch_set_result_cache(NULL);
+        result_cache_close(cache);
         return 0;
     }
 
-    if (do_encode)
+    if (calibrate_ms > 0)
+    {
+        uint32_t iters = aes_calibrate_kdf((unsigned)calibrate_ms);
+        printf("PBKDF2-HMAC-SHA256: %u iterations take about %ld ms on this machine\n", (unsigned)iters, calibrate_ms);
+        if (!do_encode)
+        {
+            return 0;
+        }
+        if (!kdf_iterations)
+        {
+            kdf_iterations = (long)iters;
+        }
+    }
+    if (kdf_iterations > 0)
     {
-        return cli_encode(cover, payload, out, lsb_depth, password, auto_convert);
+        aes_set_kdf_iterations((uint32_t)kdf_iterations);
     }
 
-    if (do_decode)
+    unsigned char key[AES_RAW_KEY_LEN];
+    if (key_file)
     {
-        return cli_decode(stego, outdir, password);
+        if (password)
+        {
+            fprintf(stderr, "Error: --password and --key-file are mutually exclusive\n");
+            return 1;
+        }
+        if (aes_load_key_file(key_file, key) != 0)
+        {
+            fprintf(stderr, "Error: Failed to read key file '%s' (need 32 bytes or 64 hex digits)\n", key_file);
+            return 1;
+        }
     }
 
-    print_usage(argv[0]);
-    return 1;
+    int rc = 1;
+    if (do_encode)
+    {
+        rc = cli_encode(cover, payload, out, lsb_depth, password, key_file ? key : NULL, cipher, compression, extra_files, extra_count, auto_convert, cache);
+    }
+    else if (do_decode)
+    {
+        rc = cli_decode(stego, outdir, password, key_file ? key : NULL, entry);
+    }
+    else if (do_encode_shards)
+    {
+        rc = cli_encode_shards(payload, outdir, shard_paths, shard_count, parity_count, lsb_depth, password,
+                               key_file ? key : NULL, cipher, compression, extra_files, extra_count);
+    }
+    else if (do_decode_shards)
+    {
+        rc = cli_decode_shards(outdir, shard_paths, shard_count, password, key_file ? key : NULL, entry);
+    }
+    else if (verify_count)
+    {
+        rc = cli_verify(verify_paths, verify_count);
+    }
+    else if (info_count)
+    {
+        rc = cli_info(info_paths, info_count, json);
+    }
+    else if (scan_dir)
+    {
+        rc = cli_scan(scan_dir, json);
+    }
+    else if (batch_manifest)
+    {
+        if (key_file)
+        {
+            fprintf(stderr, "Error: --batch takes passwords, not --key-file\n");
+        }
+        else
+        {
+            rc = cli_batch(batch_manifest, lsb_depth, password, cipher, (unsigned)batch_jobs, json);
+        }
+    }
+    else if (watch_inbox)
+    {
+        if (key_file)
+        {
+            fprintf(stderr, "Error: --watch takes passwords, not --key-file\n");
+        }
+        else
+        {
+            rc = cli_watch(watch_inbox, watch_outbox, lsb_depth, password, cipher, (unsigned)batch_jobs, json);
+        }
+    }
+    else
+    {
+        print_usage(argv[0]);
+    }
+    memset(key, 0, sizeof(key));
+    free(extra_files);
+    result_cache_close(cache);
+    return rc;
 }
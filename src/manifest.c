@@ -0,0 +1,443 @@
+/* ==========================================================
+ * manifest.c - Parsing of batch job manifests (see manifest.h)
+ * ==========================================================
+ *
+ * Each line is split in place: CSV unquoting and JSON unescaping never
+ * make a field longer than its source text, so the fields are written
+ * back into the line buffer and only copied once a job is complete.
+ */
+
+#include "../include/manifest.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum manifest_field
+{
+    FIELD_COVER,
+    FIELD_PAYLOAD,
+    FIELD_OUT,
+    FIELD_DEPTH,
+    FIELD_PASSWORD_REF,
+    FIELD_COUNT
+};
+
+/* CSV column order and JSON keys */
+static const char *const field_names[FIELD_COUNT] = {"cover", "payload", "out", "depth", "password_ref"};
+
+static char *skip_blanks(char *s)
+{
+    while (*s == ' ' || *s == '\t')
+        ++s;
+    return s;
+}
+
+/* ---------- CSV ---------- */
+
+/* Returns the number of fields, or -1 if the line is malformed */
+static int parse_csv(char *s, char *fields[FIELD_COUNT])
+{
+    int n = 0;
+    for (;;)
+    {
+        if (n == FIELD_COUNT)
+            return -1;
+        s = skip_blanks(s);
+        char *start = s;
+        char *w = s;
+        if (*s == '"')
+        {
+            ++s;
+            for (;;)
+            {
+                if (*s == '\0')
+                    return -1; /* unterminated quote */
+                if (*s == '"')
+                {
+                    if (s[1] != '"')
+                        break;
+                    ++s; /* "" is a literal quote */
+                }
+                *w++ = *s++;
+            }
+            s = skip_blanks(s + 1);
+            if (*s != ',' && *s != '\0')
+                return -1;
+        }
+        else
+        {
+            while (*s != ',' && *s != '\0')
+                ++s;
+            w = s;
+            while (w > start && (w[-1] == ' ' || w[-1] == '\t'))
+                --w;
+        }
+        char sep = *s;
+        *w = '\0'; /* may overwrite the separator, read above */
+        fields[n++] = start;
+        if (sep == '\0')
+            return n;
+        ++s;
+    }
+}
+
+/* ---------- JSON ---------- */
+
+static int hex4(const char *s, uint32_t *out)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        char c = s[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9')
+            v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            v |= (uint32_t)(c - 'A' + 10);
+        else
+            return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static char *put_utf8(char *w, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        *w++ = (char)cp;
+    }
+    else if (cp < 0x800)
+    {
+        *w++ = (char)(0xC0 | (cp >> 6));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        *w++ = (char)(0xE0 | (cp >> 12));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        *w++ = (char)(0xF0 | (cp >> 18));
+        *w++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return w;
+}
+
+/* Unescape the string starting at the quote *sp in place; *sp is left
+ * past the closing quote */
+static int json_string(char **sp, char **out)
+{
+    char *s = *sp;
+    if (*s != '"')
+        return -1;
+    char *w = ++s;
+    *out = w;
+    for (;;)
+    {
+        char c = *s++;
+        if (c == '\0')
+            return -1;
+        if (c == '"')
+            break;
+        if (c != '\\')
+        {
+            *w++ = c;
+            continue;
+        }
+        switch (c = *s++)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            *w++ = c;
+            break;
+        case 'b':
+            *w++ = '\b';
+            break;
+        case 'f':
+            *w++ = '\f';
+            break;
+        case 'n':
+            *w++ = '\n';
+            break;
+        case 'r':
+            *w++ = '\r';
+            break;
+        case 't':
+            *w++ = '\t';
+            break;
+        case 'u':
+        {
+            uint32_t cp, lo;
+            if (hex4(s, &cp) != 0)
+                return -1;
+            s += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF)
+            {
+                if (s[0] != '\\' || s[1] != 'u' || hex4(s + 2, &lo) != 0 || lo < 0xDC00 || lo > 0xDFFF)
+                    return -1;
+                s += 6;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            }
+            else if ((cp >= 0xDC00 && cp <= 0xDFFF) || cp == 0)
+            {
+                return -1;
+            }
+            w = put_utf8(w, cp);
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    *w = '\0';
+    *sp = s;
+    return 0;
+}
+
+/* One flat object of string, number or null members; keys other than
+ * the job fields are ignored. Returns 0 or -1 if the line is malformed. */
+static int parse_json(char *s, char *fields[FIELD_COUNT])
+{
+    s = skip_blanks(s);
+    if (*s++ != '{')
+        return -1;
+    s = skip_blanks(s);
+    if (*s == '}')
+        return *skip_blanks(s + 1) == '\0' ? 0 : -1;
+
+    for (;;)
+    {
+        char *key, *value;
+        if (json_string(&s, &key) != 0)
+            return -1;
+        s = skip_blanks(s);
+        if (*s++ != ':')
+            return -1;
+        s = skip_blanks(s);
+
+        bool quoted = *s == '"';
+        if (quoted)
+        {
+            if (json_string(&s, &value) != 0)
+                return -1;
+        }
+        else
+        {
+            /* number, null, true or false */
+            value = s;
+            while ((*s >= '0' && *s <= '9') || (*s >= 'a' && *s <= 'z') || *s == '-' || *s == '+' || *s == '.' ||
+                   *s == 'E')
+                ++s;
+            if (s == value)
+                return -1;
+        }
+        char *end = s;
+        s = skip_blanks(s);
+        char delim = *s;
+        if (delim != ',' && delim != '}')
+            return -1;
+        *end = '\0'; /* may overwrite the delimiter, read above */
+        ++s;
+
+        if (!quoted && strcmp(value, "null") == 0)
+            value = NULL;
+        for (int f = 0; f < FIELD_COUNT; ++f)
+        {
+            if (strcmp(key, field_names[f]) == 0)
+                fields[f] = value;
+        }
+
+        if (delim == '}')
+            break;
+        s = skip_blanks(s);
+    }
+    return *skip_blanks(s) == '\0' ? 0 : -1;
+}
+
+/* ---------- jobs ---------- */
+
+static void job_free(struct ManifestJob *job)
+{
+    free(job->cover);
+    free(job->payload);
+    free(job->out);
+    free(job->password_ref);
+}
+
+static bool is_empty(const char *s)
+{
+    return !s || *s == '\0';
+}
+
+/* Returns 0, -3 for a bad field or -4 if out of memory */
+static int job_from_fields(char *fields[FIELD_COUNT], unsigned line, struct ManifestJob *job)
+{
+    memset(job, 0, sizeof(*job));
+    job->line = line;
+    if (is_empty(fields[FIELD_COVER]) || is_empty(fields[FIELD_PAYLOAD]) || is_empty(fields[FIELD_OUT]))
+        return -3;
+
+    if (!is_empty(fields[FIELD_DEPTH]))
+    {
+        const char *d = fields[FIELD_DEPTH];
+        if (d[1] != '\0' || d[0] < '1' || d[0] > '3')
+            return -3;
+        job->lsb_depth = d[0] - '0';
+    }
+
+    job->cover = strdup(fields[FIELD_COVER]);
+    job->payload = strdup(fields[FIELD_PAYLOAD]);
+    job->out = strdup(fields[FIELD_OUT]);
+    if (!is_empty(fields[FIELD_PASSWORD_REF]))
+        job->password_ref = strdup(fields[FIELD_PASSWORD_REF]);
+    if (!job->cover || !job->payload || !job->out || (!is_empty(fields[FIELD_PASSWORD_REF]) && !job->password_ref))
+    {
+        job_free(job);
+        return -4;
+    }
+    return 0;
+}
+
+static int push_job(struct Manifest *m, size_t *cap, const struct ManifestJob *job)
+{
+    if (m->count == *cap)
+    {
+        size_t new_cap = *cap ? *cap * 2 : 64;
+        struct ManifestJob *grown = realloc(m->jobs, new_cap * sizeof(*grown));
+        if (!grown)
+            return -4;
+        m->jobs = grown;
+        *cap = new_cap;
+    }
+    m->jobs[m->count++] = *job;
+    return 0;
+}
+
+/* ---------- public API ---------- */
+
+int manifest_load(const char *path, struct Manifest *out, unsigned *bad_line)
+{
+    if (!path || !out)
+        return -1;
+    out->jobs = NULL;
+    out->count = 0;
+
+    bool from_stdin = strcmp(path, "-") == 0;
+    FILE *f = from_stdin ? stdin : fopen(path, "r");
+    if (!f)
+        return -2;
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    size_t jobs_cap = 0;
+    unsigned line_no = 0;
+    bool header_allowed = true;
+    int rc = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, f)) >= 0)
+    {
+        ++line_no;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        char *s = skip_blanks(line);
+        if (*s == '\0' || *s == '#')
+            continue;
+
+        char *fields[FIELD_COUNT] = {0};
+        if (*s == '{')
+        {
+            rc = parse_json(s, fields) == 0 ? 0 : -3;
+        }
+        else
+        {
+            int n = parse_csv(s, fields);
+            if (n >= 1 && header_allowed && strcmp(fields[0], field_names[FIELD_COVER]) == 0)
+            {
+                header_allowed = false;
+                continue;
+            }
+            rc = n >= 3 ? 0 : -3;
+        }
+        header_allowed = false;
+
+        struct ManifestJob job;
+        if (rc == 0)
+            rc = job_from_fields(fields, line_no, &job);
+        if (rc == 0 && (rc = push_job(out, &jobs_cap, &job)) != 0)
+            job_free(&job);
+        if (rc != 0)
+            break;
+    }
+    if (rc == 0 && ferror(f))
+        rc = -2;
+
+    free(line);
+    if (!from_stdin)
+        fclose(f);
+    if (rc != 0)
+    {
+        if (bad_line && rc == -3)
+            *bad_line = line_no;
+        manifest_free(out);
+    }
+    return rc;
+}
+
+void manifest_free(struct Manifest *m)
+{
+    if (!m)
+        return;
+    for (size_t i = 0; i < m->count; ++i)
+        job_free(&m->jobs[i]);
+    free(m->jobs);
+    m->jobs = NULL;
+    m->count = 0;
+}
+
+int manifest_resolve_password(const char *ref, char **password)
+{
+    if (!ref || !password)
+        return -1;
+    *password = NULL;
+
+    if (strncmp(ref, "env:", 4) == 0)
+    {
+        const char *value = getenv(ref + 4);
+        if (is_empty(value))
+            return -2;
+        *password = strdup(value);
+        return *password ? 0 : -4;
+    }
+    if (strncmp(ref, "file:", 5) == 0)
+    {
+        FILE *f = fopen(ref + 5, "r");
+        if (!f)
+            return -2;
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t len = getline(&line, &cap, f);
+        fclose(f);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len <= 0)
+        {
+            /* an empty password would silently mean "unencrypted" */
+            free(line);
+            return -2;
+        }
+        *password = line;
+        return 0;
+    }
+    return -3;
+}
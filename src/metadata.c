@@ -5,6 +5,9 @@
  */
 
 #include "../include/metadata.h"
+#include "../include/varint.h"
+#include "../include/compress.h"
+#include "../include/payload.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -20,6 +23,20 @@ struct Metadata metadata_create_from_payload(const char *filename, size_t file_s
     m.file_size = file_size;
     m.lsb_depth = lsb_depth;
     m.encrypted = encrypted;
+    m.cipher = encrypted ? 1 : 0; /* PAYLOAD_CIPHER_AES256_CBC */
+    m.compression = 0;
+    m.original_size = file_size;
+    m.has_crc = false;
+    m.crc32c = 0;
+    m.archive = false;
+    m.sharded = false;
+    m.payload_id = 0;
+    m.shard_index = 0;
+    m.shard_count = 1;
+    m.shard_offset = 0;
+    m.total_size = file_size;
+    m.data_shards = 1;
+    m.version = METADATA_VERSION_CURRENT;
     return m;
 }
 
@@ -28,12 +45,17 @@ void metadata_free(struct Metadata *m)
     (void)m; /* nothing dynamic for now */
 }
 
-int metadata_serialize(const struct Metadata *meta, unsigned char **out_buf, size_t *out_size)
-{
-    if (!meta || !out_buf || !out_size)
-        return -1;
+/* ---- v1: fixed 273-byte record ----
+ * [magic "STEG"][filename 256][file_size u64 LE][lsb_depth u32 LE][cipher]
+ * optionally followed by [compression][original_size u64 LE]. */
+
+#define METADATA_V1_SIZE (4 + 256 + 8 + 4 + 1)
 
-    size_t total = 4 + 256 + 8 + 4 + 1; /* magic + filename + size + lsb_depth + encrypted */
+static int serialize_v1(const struct Metadata *meta, unsigned char **out_buf, size_t *out_size)
+{
+    size_t total = METADATA_V1_SIZE; /* magic + filename + size + lsb_depth + cipher */
+    if (meta->compression)
+        total += 1 + 8; /* compression method + original size */
     unsigned char *buf = malloc(total);
     if (!buf)
         return -2;
@@ -54,27 +76,31 @@ int metadata_serialize(const struct Metadata *meta, unsigned char **out_buf, siz
     for (int i = 0; i < 4; ++i)
         buf[offset++] = (unsigned char)((depth >> (8 * i)) & 0xFF);
 
-    buf[offset++] = meta->encrypted ? 1 : 0;
+    /* Older readers only test this byte for non-zero */
+    buf[offset++] = meta->encrypted ? (meta->cipher ? meta->cipher : 1) : 0;
+
+    /* Trailing compression fields; older readers ignore extra bytes */
+    if (meta->compression)
+    {
+        buf[offset++] = meta->compression;
+        uint64_t orig = meta->original_size;
+        for (int i = 0; i < 8; ++i)
+            buf[offset++] = (unsigned char)((orig >> (8 * i)) & 0xFF);
+    }
 
     *out_buf = buf;
     *out_size = total;
     return 0;
 }
 
-int metadata_parse(const unsigned char *buf, size_t buf_size, struct Metadata *meta_out)
+static int parse_v1(const unsigned char *buf, size_t buf_size, struct Metadata *meta_out)
 {
-    if (!buf || !meta_out)
-        return -1;
-    if (buf_size < 4 + 256 + 8 + 4 + 1)
+    if (buf_size < METADATA_V1_SIZE)
         return -2;
 
-    size_t offset = 0;
-    memcpy(meta_out->magic, buf + offset, 4);
-    offset += 4;
-    if (memcmp(meta_out->magic, METADATA_MAGIC, 4) != 0)
-        return -3;
-
+    size_t offset = 4;
     memcpy(meta_out->original_filename, buf + offset, 256);
+    meta_out->original_filename[255] = '\0';
     offset += 256;
 
     uint64_t size = 0;
@@ -87,8 +113,275 @@ int metadata_parse(const unsigned char *buf, size_t buf_size, struct Metadata *m
         depth |= ((uint32_t)buf[offset++]) << (8 * i);
     meta_out->lsb_depth = (int)depth;
 
-    meta_out->encrypted = buf[offset++] != 0;
+    meta_out->cipher = buf[offset++];
+    meta_out->encrypted = meta_out->cipher != 0;
+
+    meta_out->compression = 0;
+    meta_out->original_size = size;
+    if (buf_size >= offset + 1 + 8)
+    {
+        meta_out->compression = buf[offset++];
+        uint64_t orig = 0;
+        for (int i = 0; i < 8; ++i)
+            orig |= ((uint64_t)buf[offset++]) << (8 * i);
+        meta_out->original_size = orig;
+    }
+
+    meta_out->has_crc = false;
+    meta_out->crc32c = 0;
+    meta_out->archive = false;
+    meta_out->sharded = false;
+    meta_out->payload_id = 0;
+    meta_out->shard_index = 0;
+    meta_out->shard_count = 1;
+    meta_out->shard_offset = 0;
+    meta_out->total_size = size;
+    meta_out->data_shards = 1;
+    meta_out->version = METADATA_VERSION_1;
+    return 0;
+}
+
+/* ---- v2: compact record ----
+ * [magic "SG"][version 2][flags]
+ * [crc32c u32 LE]                      if METADATA_F_CRC32C
+ * [file_size varint][lsb_depth]
+ * [cipher]                             if METADATA_F_ENCRYPTED
+ * [compression][original_size varint]  if METADATA_F_COMPRESSED
+ * [payload_id u64 LE][shard_index varint][shard_count varint]
+ * [shard_offset varint][total_size varint]  if METADATA_F_SHARD
+ * [data_shards varint]                 if METADATA_F_PARITY (with F_SHARD)
+ * [name_len varint][name, UTF-8, no NUL]
+ * Varints are unsigned LEB128. A short name and a small payload come to
+ * well under 32 bytes, against 273 for v1. The checksum sits at a fixed
+ * offset (METADATA_V2_CRC_OFFSET) so a streaming writer can patch it in
+ * after the payload has gone by. */
+
+#define METADATA_V2_MAGIC "SG"
+#define METADATA_F_ENCRYPTED 0x01
+#define METADATA_F_COMPRESSED 0x02
+#define METADATA_F_CRC32C 0x04
+#define METADATA_F_ARCHIVE 0x08 /* payload is a multi-file archive (payload.h) */
+#define METADATA_F_SHARD 0x10   /* image holds one shard of a larger payload */
+#define METADATA_F_PARITY 0x20  /* the shard set is erasure coded (reed_solomon.h) */
+
+static int serialize_v2(const struct Metadata *meta, unsigned char **out_buf, size_t *out_size)
+{
+    const char *nul = memchr(meta->original_filename, '\0', sizeof(meta->original_filename));
+    size_t name_len = nul ? (size_t)(nul - meta->original_filename) : sizeof(meta->original_filename) - 1;
+
+    /* upper bound: fixed bytes + all varints + name */
+    unsigned char *buf = malloc(2 + 1 + 1 + 4 + 10 + 1 + 1 + 1 + 10 + 8 + 5 * 10 + 2 + name_len);
+    if (!buf)
+        return -2;
+
+    unsigned char flags = 0;
+    if (meta->encrypted)
+        flags |= METADATA_F_ENCRYPTED;
+    if (meta->compression)
+        flags |= METADATA_F_COMPRESSED;
+    if (meta->has_crc)
+        flags |= METADATA_F_CRC32C;
+    if (meta->archive)
+        flags |= METADATA_F_ARCHIVE;
+    if (meta->sharded)
+        flags |= METADATA_F_SHARD;
+    if (meta->sharded && meta->data_shards < meta->shard_count)
+        flags |= METADATA_F_PARITY;
+
+    size_t offset = 0;
+    memcpy(buf + offset, METADATA_V2_MAGIC, 2);
+    offset += 2;
+    buf[offset++] = METADATA_VERSION_2;
+    buf[offset++] = flags;
+    if (flags & METADATA_F_CRC32C)
+    {
+        for (int i = 0; i < 4; ++i)
+            buf[offset++] = (unsigned char)((meta->crc32c >> (8 * i)) & 0xFF);
+    }
+    offset += put_varint(buf + offset, meta->file_size);
+    buf[offset++] = (unsigned char)meta->lsb_depth;
+    if (flags & METADATA_F_ENCRYPTED)
+        buf[offset++] = meta->cipher ? meta->cipher : 1;
+    if (flags & METADATA_F_COMPRESSED)
+    {
+        buf[offset++] = meta->compression;
+        offset += put_varint(buf + offset, meta->original_size);
+    }
+    if (flags & METADATA_F_SHARD)
+    {
+        for (int i = 0; i < 8; ++i)
+            buf[offset++] = (unsigned char)((meta->payload_id >> (8 * i)) & 0xFF);
+        offset += put_varint(buf + offset, meta->shard_index);
+        offset += put_varint(buf + offset, meta->shard_count);
+        offset += put_varint(buf + offset, meta->shard_offset);
+        offset += put_varint(buf + offset, meta->total_size);
+    }
+    if (flags & METADATA_F_PARITY)
+        offset += put_varint(buf + offset, meta->data_shards);
+    offset += put_varint(buf + offset, name_len);
+    memcpy(buf + offset, meta->original_filename, name_len);
+    offset += name_len;
+
+    *out_buf = buf;
+    *out_size = offset;
+    return 0;
+}
+
+static int parse_v2(const unsigned char *buf, size_t buf_size, struct Metadata *meta_out)
+{
+    /* The extractor probes LSB depths by parsing whatever bytes it finds,
+     * so every field is checked and trailing bytes are not allowed. */
+    size_t offset = 3;
+    if (buf_size < offset + 1)
+        return -2;
+    unsigned char flags = buf[offset++];
+    if (flags & ~(METADATA_F_ENCRYPTED | METADATA_F_COMPRESSED | METADATA_F_CRC32C | METADATA_F_ARCHIVE | METADATA_F_SHARD | METADATA_F_PARITY))
+        return -3;
+    meta_out->archive = (flags & METADATA_F_ARCHIVE) != 0;
+
+    meta_out->has_crc = (flags & METADATA_F_CRC32C) != 0;
+    meta_out->crc32c = 0;
+    if (meta_out->has_crc)
+    {
+        if (buf_size < offset + 4)
+            return -2;
+        for (int i = 0; i < 4; ++i)
+            meta_out->crc32c |= ((uint32_t)buf[offset++]) << (8 * i);
+    }
+
+    uint64_t size = 0;
+    if (get_varint(buf, buf_size, &offset, &size) != 0 || offset >= buf_size)
+        return -2;
+    meta_out->file_size = size;
+
+    unsigned char depth = buf[offset++];
+    if (depth < 1 || depth > 3)
+        return -3;
+    meta_out->lsb_depth = depth;
+
+    meta_out->cipher = 0;
+    if (flags & METADATA_F_ENCRYPTED)
+    {
+        if (offset >= buf_size)
+            return -2;
+        meta_out->cipher = buf[offset++];
+        if (meta_out->cipher == 0)
+            return -3;
+    }
+    meta_out->encrypted = meta_out->cipher != 0;
 
+    meta_out->compression = 0;
+    meta_out->original_size = size;
+    if (flags & METADATA_F_COMPRESSED)
+    {
+        if (offset >= buf_size)
+            return -2;
+        meta_out->compression = buf[offset++];
+        if (meta_out->compression == 0)
+            return -3;
+        if (get_varint(buf, buf_size, &offset, &meta_out->original_size) != 0)
+            return -2;
+    }
+
+    meta_out->sharded = (flags & METADATA_F_SHARD) != 0;
+    meta_out->payload_id = 0;
+    meta_out->shard_index = 0;
+    meta_out->shard_count = 1;
+    meta_out->shard_offset = 0;
+    meta_out->total_size = size;
+    meta_out->data_shards = 1;
+    if ((flags & METADATA_F_PARITY) && !meta_out->sharded)
+        return -3;
+    if (meta_out->sharded)
+    {
+        if (buf_size < offset + 8)
+            return -2;
+        for (int i = 0; i < 8; ++i)
+            meta_out->payload_id |= ((uint64_t)buf[offset++]) << (8 * i);
+        uint64_t index, count;
+        if (get_varint(buf, buf_size, &offset, &index) != 0 ||
+            get_varint(buf, buf_size, &offset, &count) != 0 ||
+            get_varint(buf, buf_size, &offset, &meta_out->shard_offset) != 0 ||
+            get_varint(buf, buf_size, &offset, &meta_out->total_size) != 0)
+            return -2;
+        if (count == 0 || count > METADATA_MAX_SHARDS || index >= count)
+            return -3;
+        uint64_t data_shards = count;
+        if (flags & METADATA_F_PARITY)
+        {
+            /* every coded shard is one full stripe of the payload */
+            if (get_varint(buf, buf_size, &offset, &data_shards) != 0)
+                return -2;
+            if (data_shards == 0 || data_shards >= count || count > METADATA_MAX_CODED_SHARDS ||
+                meta_out->shard_offset != 0 ||
+                size != meta_out->total_size / data_shards + (meta_out->total_size % data_shards != 0))
+                return -3;
+        }
+        else if (meta_out->shard_offset > meta_out->total_size ||
+                 size > meta_out->total_size - meta_out->shard_offset)
+            return -3;
+        meta_out->shard_index = (uint32_t)index;
+        meta_out->shard_count = (uint32_t)count;
+        meta_out->data_shards = (uint32_t)data_shards;
+    }
+
+    uint64_t name_len = 0;
+    if (get_varint(buf, buf_size, &offset, &name_len) != 0)
+        return -2;
+    if (name_len >= sizeof(meta_out->original_filename) || name_len != buf_size - offset)
+        return -3;
+    memcpy(meta_out->original_filename, buf + offset, (size_t)name_len);
+    meta_out->original_filename[name_len] = '\0';
+    if (memchr(meta_out->original_filename, '\0', (size_t)name_len))
+        return -3;
+
+    memcpy(meta_out->magic, METADATA_MAGIC, 4);
+    meta_out->version = METADATA_VERSION_2;
+    return 0;
+}
+
+int metadata_serialize(const struct Metadata *meta, unsigned char **out_buf, size_t *out_size)
+{
+    if (!meta || !out_buf || !out_size)
+        return -1;
+    if (meta->version == METADATA_VERSION_1)
+    {
+        if (meta->archive || meta->sharded)
+            return -3; /* v1 has no way to mark an archive or a shard */
+        return serialize_v1(meta, out_buf, out_size);
+    }
+    return serialize_v2(meta, out_buf, out_size);
+}
+
+int metadata_parse(const unsigned char *buf, size_t buf_size, struct Metadata *meta_out)
+{
+    if (!buf || !meta_out)
+        return -1;
+    if (buf_size < 4)
+        return -2;
+
+    int rc;
+    if (memcmp(buf, METADATA_MAGIC, 4) == 0)
+    {
+        memcpy(meta_out->magic, buf, 4);
+        rc = parse_v1(buf, buf_size, meta_out);
+    }
+    else if (memcmp(buf, METADATA_V2_MAGIC, 2) == 0 && buf[2] == METADATA_VERSION_2)
+        rc = parse_v2(buf, buf_size, meta_out);
+    else
+        return -3;
+    if (rc != 0)
+        return rc;
+
+    /* A single-file payload is saved as out_dir/original_filename, so the
+     * name must not point anywhere else. An archive's name is only shown. */
+    if (!meta_out->archive && !payload_name_ok(meta_out->original_filename, strlen(meta_out->original_filename)))
+        return -3;
+    /* Readers allocate original_size bytes before inflating; refuse a size
+     * no codec could produce from the whole payload (total_size is
+     * file_size unless sharded). */
+    if (meta_out->compression && meta_out->original_size / COMPRESS_MAX_RATIO > meta_out->total_size)
+        return -3;
     return 0;
 }
 
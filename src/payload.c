@@ -5,49 +5,166 @@
  */
 
 #include "../include/payload.h"
+#include "../include/varint.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libgen.h>
+
+/* Files at least this big are mapped instead of read into a heap copy */
+#define PAYLOAD_MMAP_MIN (256 * 1024)
+
+/* Chunk size for pwrite()/write() on output */
+#define PAYLOAD_WRITE_CHUNK (8 * 1024 * 1024)
+
+static int read_fully(int fd, unsigned char *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = read(fd, buf + done, len - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/* Load sz bytes of an open regular file, mapping it if it is large. The
+ * caller closes fd; a mapping outlives it. */
+static int load_regular(int fd, size_t sz, struct Payload *out)
+{
+    if (sz >= PAYLOAD_MMAP_MIN)
+    {
+        void *map = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            madvise(map, sz, MADV_SEQUENTIAL);
+            out->data = map;
+            out->size = sz;
+            out->encrypted = 0;
+            out->map_len = sz;
+            return 0;
+        }
+        /* fall back to reading (e.g. filesystems without mmap) */
+    }
+
+    unsigned char *buf = malloc(sz ? sz : 1);
+    if (!buf)
+        return -5;
+
+    if (read_fully(fd, buf, sz) != 0)
+    {
+        free(buf);
+        return -6;
+    }
+
+    out->data = buf;
+    out->size = sz;
+    out->encrypted = 0;
+    out->map_len = 0;
+    return 0;
+}
 
 int payload_load_from_file(const char *path, struct Payload *out)
 {
     if (!path || !out)
         return -1;
-    FILE *f = fopen(path, "rb");
-    if (!f)
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
         return -2;
 
-    if (fseek(f, 0, SEEK_END) != 0)
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
     {
-        fclose(f);
+        close(fd);
         return -3;
     }
-    long sz = ftell(f);
-    if (sz < 0)
+    if (st.st_size < 0 || (unsigned long long)st.st_size > (size_t)-1)
     {
-        fclose(f);
+        close(fd);
         return -4;
     }
-    rewind(f);
 
-    unsigned char *buf = malloc((size_t)sz);
-    if (!buf)
+    int rc = load_regular(fd, (size_t)st.st_size, out);
+    close(fd);
+    return rc;
+}
+
+int payload_load_from_fd(int fd, struct Payload *out)
+{
+    if (fd < 0 || !out)
+        return -1;
+
+    /* a regular file redirected in from its start loads like a path */
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) == 0)
     {
-        fclose(f);
-        return -5;
+        if ((unsigned long long)st.st_size > (size_t)-1)
+            return -4;
+        return load_regular(fd, (size_t)st.st_size, out);
     }
 
-    size_t r = fread(buf, 1, (size_t)sz, f);
-    fclose(f);
-    if (r != (size_t)sz)
+    /* pipe or socket: the size is only known at EOF */
+    size_t cap = 64 * 1024;
+    size_t len = 0;
+    unsigned char *buf = malloc(cap);
+    if (!buf)
+        return -5;
+    for (;;)
     {
-        free(buf);
-        return -6;
+        if (len == cap)
+        {
+            unsigned char *grown = cap * 2 > cap ? realloc(buf, cap * 2) : NULL;
+            if (!grown)
+            {
+                free(buf);
+                return -5;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + len, cap - len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+        {
+            free(buf);
+            return -6;
+        }
+        if (r == 0)
+            break;
+        len += (size_t)r;
     }
 
     out->data = buf;
-    out->size = (size_t)sz;
+    out->size = len;
     out->encrypted = 0;
+    out->map_len = 0;
+    return 0;
+}
+
+int payload_make_owned(struct Payload *p)
+{
+    if (!p)
+        return -1;
+    if (!p->map_len)
+        return 0;
+
+    unsigned char *buf = malloc(p->size ? p->size : 1);
+    if (!buf)
+        return -2;
+    memcpy(buf, p->data, p->size);
+    munmap(p->data, p->map_len);
+    p->data = buf;
+    p->map_len = 0;
     return 0;
 }
 
@@ -65,6 +182,7 @@ int payload_from_text(const char *text, struct Payload *out)
     out->data = buf;
     out->size = len;
     out->encrypted = 0;
+    out->map_len = 0;
     return 0;
 }
 
@@ -72,21 +190,67 @@ int payload_write_to_file(const struct Payload *payload, const char *outpath)
 {
     if (!payload || !outpath)
         return -1;
-    FILE *f = fopen(outpath, "wb");
-    if (!f)
+    int fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
         return -2;
-    size_t w = fwrite(payload->data, 1, payload->size, f);
-    fclose(f);
-    if (w != payload->size)
+
+    /* Reserve the blocks up front so large outputs are laid out in one
+     * go; filesystems that cannot preallocate just skip this. */
+    if (payload->size > 0)
+        posix_fallocate(fd, 0, (off_t)payload->size);
+
+    size_t done = 0;
+    while (done < payload->size)
+    {
+        size_t n = payload->size - done;
+        if (n > PAYLOAD_WRITE_CHUNK)
+            n = PAYLOAD_WRITE_CHUNK;
+        ssize_t w = pwrite(fd, payload->data + done, n, (off_t)done);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+        {
+            close(fd);
+            return -3;
+        }
+        done += (size_t)w;
+    }
+    if (close(fd) != 0)
         return -3;
     return 0;
 }
 
+int payload_write_to_fd(const struct Payload *payload, int fd)
+{
+    if (!payload || fd < 0)
+        return -1;
+    size_t done = 0;
+    while (done < payload->size)
+    {
+        size_t n = payload->size - done;
+        if (n > PAYLOAD_WRITE_CHUNK)
+            n = PAYLOAD_WRITE_CHUNK;
+        ssize_t w = write(fd, payload->data + done, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -3;
+        done += (size_t)w;
+    }
+    return 0;
+}
+
 void payload_free(struct Payload *p)
 {
     if (!p)
         return;
-    if (p->data)
+    if (p->data && p->map_len)
+    {
+        /* file-backed and read-only: nothing to scrub */
+        munmap(p->data, p->map_len);
+        p->data = NULL;
+    }
+    else if (p->data)
     {
         /* optionally zero memory before free for security */
         memset(p->data, 0, p->size);
@@ -95,4 +259,263 @@ void payload_free(struct Payload *p)
     }
     p->size = 0;
     p->encrypted = 0;
+    p->map_len = 0;
+}
+
+/* ---------- Archive payloads ---------- */
+
+int payload_name_ok(const char *name, size_t len)
+{
+    if (len == 0 || len > 255)
+        return 0;
+    if ((len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.'))
+        return 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (name[i] == '/' || name[i] == '\\' || name[i] == '\0')
+            return 0;
+    }
+    return 1;
+}
+
+int payload_archive_build(const char *const *paths, size_t count, struct Payload *out)
+{
+    if (!paths || !out || count == 0)
+        return -1;
+
+    struct PayloadArchiveEntry *entries = calloc(count, sizeof(*entries));
+    if (!entries)
+        return -5;
+
+    /* Pass 1: names, sizes and the index length */
+    unsigned char tmp[VARINT_MAX_LEN];
+    size_t index_len = put_varint(tmp, count);
+    uint64_t bodies_len = 0;
+    int rc = 0;
+    for (size_t i = 0; i < count && rc == 0; ++i)
+    {
+        struct stat st;
+        if (stat(paths[i], &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            rc = -2;
+            break;
+        }
+        char *copy = strdup(paths[i]);
+        if (!copy)
+        {
+            rc = -5;
+            break;
+        }
+        const char *base = basename(copy);
+        size_t len = strlen(base);
+        if (!payload_name_ok(base, len))
+            rc = -3;
+        else
+            memcpy(entries[i].name, base, len + 1);
+        free(copy);
+        for (size_t j = 0; j < i && rc == 0; ++j)
+        {
+            if (strcmp(entries[j].name, entries[i].name) == 0)
+                rc = -7;
+        }
+        if (rc)
+            break;
+
+        entries[i].offset = bodies_len;
+        entries[i].size = (uint64_t)st.st_size;
+        entries[i].flags = (st.st_mode & S_IXUSR) ? PAYLOAD_ARCHIVE_F_EXEC : 0;
+        bodies_len += entries[i].size;
+
+        index_len += put_varint(tmp, len) + len + put_varint(tmp, entries[i].offset) +
+                     put_varint(tmp, entries[i].size) + 1;
+    }
+    if (rc)
+    {
+        free(entries);
+        return rc;
+    }
+
+    size_t header_len = put_varint(tmp, index_len) + index_len;
+    if (bodies_len > (uint64_t)((size_t)-1 - header_len))
+    {
+        free(entries);
+        return -4;
+    }
+    size_t total = header_len + (size_t)bodies_len;
+    unsigned char *buf = malloc(total ? total : 1);
+    if (!buf)
+    {
+        free(entries);
+        return -5;
+    }
+
+    /* Pass 2: index, then each body read straight into place */
+    size_t off = put_varint(buf, index_len);
+    off += put_varint(buf + off, count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t len = strlen(entries[i].name);
+        off += put_varint(buf + off, len);
+        memcpy(buf + off, entries[i].name, len);
+        off += len;
+        off += put_varint(buf + off, entries[i].offset);
+        off += put_varint(buf + off, entries[i].size);
+        buf[off++] = entries[i].flags;
+    }
+    for (size_t i = 0; i < count && rc == 0; ++i)
+    {
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            rc = -2;
+            break;
+        }
+        /* a file that changed size since pass 1 fails here */
+        unsigned char extra;
+        if (read_fully(fd, buf + header_len + entries[i].offset, (size_t)entries[i].size) != 0 ||
+            read(fd, &extra, 1) != 0)
+            rc = -6;
+        close(fd);
+    }
+    free(entries);
+    if (rc)
+    {
+        free(buf);
+        return rc;
+    }
+
+    out->data = buf;
+    out->size = total;
+    out->encrypted = 0;
+    out->map_len = 0;
+    return 0;
+}
+
+int payload_archive_header_len(const unsigned char *buf, size_t avail, size_t *need)
+{
+    if (!buf || !need)
+        return -1;
+    size_t off = 0;
+    uint64_t index_len = 0;
+    if (get_varint(buf, avail, &off, &index_len) != 0)
+        return -3;
+    if (index_len > (uint64_t)((size_t)-1 - off))
+        return -3;
+    *need = off + (size_t)index_len;
+    return 0;
+}
+
+int payload_archive_open(const unsigned char *buf, size_t buf_len, uint64_t total_len, struct PayloadArchive *out)
+{
+    if (!buf || !out)
+        return -1;
+    memset(out, 0, sizeof(*out));
+
+    size_t header_len = 0;
+    if (payload_archive_header_len(buf, buf_len, &header_len) != 0 || header_len > buf_len ||
+        header_len > total_len)
+        return -3;
+    uint64_t bodies_len = total_len - header_len;
+
+    size_t off = 0;
+    uint64_t index_len = 0, count = 0;
+    get_varint(buf, buf_len, &off, &index_len);
+    if (get_varint(buf, header_len, &off, &count) != 0)
+        return -3;
+    /* every entry takes at least four bytes */
+    if (count == 0 || count > (header_len - off) / 4)
+        return -3;
+
+    struct PayloadArchiveEntry *entries = calloc((size_t)count, sizeof(*entries));
+    if (!entries)
+        return -5;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t len = 0;
+        if (get_varint(buf, header_len, &off, &len) != 0 || len > header_len - off ||
+            !payload_name_ok((const char *)buf + off, (size_t)len))
+            goto bad;
+        memcpy(entries[i].name, buf + off, (size_t)len);
+        entries[i].name[len] = '\0';
+        off += (size_t)len;
+        if (get_varint(buf, header_len, &off, &entries[i].offset) != 0 ||
+            get_varint(buf, header_len, &off, &entries[i].size) != 0 ||
+            off >= header_len)
+            goto bad;
+        entries[i].flags = buf[off++];
+        if (entries[i].offset > bodies_len || entries[i].size > bodies_len - entries[i].offset)
+            goto bad;
+    }
+    if (off != header_len)
+        goto bad;
+
+    out->entries = entries;
+    out->count = (size_t)count;
+    out->bodies_offset = header_len;
+    return 0;
+
+bad:
+    free(entries);
+    return -3;
+}
+
+const struct PayloadArchiveEntry *payload_archive_find(const struct PayloadArchive *a, const char *name)
+{
+    if (!a || !name)
+        return NULL;
+    for (size_t i = 0; i < a->count; ++i)
+    {
+        if (strcmp(a->entries[i].name, name) == 0)
+            return &a->entries[i];
+    }
+    return NULL;
+}
+
+void payload_archive_free(struct PayloadArchive *a)
+{
+    if (!a)
+        return;
+    free(a->entries);
+    a->entries = NULL;
+    a->count = 0;
+}
+
+int payload_archive_write_entry(const struct PayloadArchiveEntry *e, const unsigned char *data, const char *out_dir)
+{
+    if (!e || (!data && e->size) || !out_dir)
+        return -1;
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/%s", out_dir, e->name) >= (int)sizeof(path))
+        return -4;
+
+    struct Payload view = {(unsigned char *)data, (size_t)e->size, 0, 0};
+    int rc = payload_write_to_file(&view, path);
+    if (rc == 0 && (e->flags & PAYLOAD_ARCHIVE_F_EXEC))
+        chmod(path, 0755);
+    return rc;
+}
+
+int payload_archive_extract(const struct Payload *archive, const char *name, const char *out_dir)
+{
+    if (!archive || !out_dir)
+        return -1;
+
+    struct PayloadArchive a;
+    int rc = payload_archive_open(archive->data, archive->size, archive->size, &a);
+    if (rc != 0)
+        return rc;
+
+    const unsigned char *bodies = archive->data + a.bodies_offset;
+    if (name)
+    {
+        const struct PayloadArchiveEntry *e = payload_archive_find(&a, name);
+        rc = e ? payload_archive_write_entry(e, bodies + e->offset, out_dir) : -8;
+    }
+    else
+    {
+        for (size_t i = 0; i < a.count && rc == 0; ++i)
+            rc = payload_archive_write_entry(&a.entries[i], bodies + a.entries[i].offset, out_dir);
+    }
+    payload_archive_free(&a);
+    return rc;
 }
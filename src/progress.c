@@ -0,0 +1,59 @@
+/* ==========================================================
+ * progress.c - Per-thread progress counters
+ * ==========================================================
+ */
+
+#include "../include/progress.h"
+
+#include <stddef.h>
+
+static _Thread_local unsigned int *progress_sink;
+static _Thread_local unsigned int stage_start;
+static _Thread_local unsigned int stage_span;
+static _Thread_local unsigned int last_value; /* only this thread writes the sink */
+
+static unsigned int to_units(double fraction)
+{
+    if (!(fraction > 0.0))
+        return 0;
+    if (fraction >= 1.0)
+        return PROGRESS_ONE;
+    return (unsigned int)(fraction * PROGRESS_ONE);
+}
+
+static void publish(unsigned int value)
+{
+    if (value > last_value)
+    {
+        last_value = value;
+        __atomic_store_n(progress_sink, value, __ATOMIC_RELAXED);
+    }
+}
+
+void progress_set_sink(unsigned int *counter)
+{
+    progress_sink = counter;
+    last_value = counter ? __atomic_load_n(counter, __ATOMIC_RELAXED) : 0;
+    stage_start = 0;
+    stage_span = PROGRESS_ONE;
+}
+
+void progress_set_stage(double start, double end)
+{
+    if (!progress_sink)
+        return;
+    unsigned int lo = to_units(start);
+    unsigned int hi = to_units(end);
+    stage_start = lo;
+    stage_span = hi > lo ? hi - lo : 0;
+    publish(lo);
+}
+
+void progress_update(uint64_t done, uint64_t total)
+{
+    if (!progress_sink || total == 0)
+        return;
+    if (done > total)
+        done = total;
+    publish(stage_start + (unsigned int)(stage_span * ((double)done / (double)total)));
+}
@@ -0,0 +1,342 @@
+/* ==========================================================
+ * reed_solomon.c - Reed-Solomon erasure code over GF(2^8)
+ * ==========================================================
+ *
+ * Field polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D). The code matrix is
+ * [ I_k ; C ] with C[r][c] = 1 / (x_r + y_c), x_r = k + r, y_c = c: a
+ * Cauchy matrix, so any k rows of the full matrix are independent.
+ *
+ * All heavy lifting is dst ^= c * src over long regions. With pshufb this
+ * is two 16-entry table lookups per byte (low and high nibble), 16 or 32
+ * bytes per instruction; without it a 256-entry row of the product table.
+ * Regions are walked in RS_BLOCK-byte slices so each slice of every input
+ * stays in cache while all outputs are updated from it.
+ */
+
+#include "../include/reed_solomon.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RS_HAVE_X86_SIMD 1
+#endif
+
+#define RS_BLOCK (32 * 1024)
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_mul_table[256][256];
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+static void gf_init(void)
+{
+    unsigned x = 1;
+    for (int i = 0; i < 255; ++i)
+    {
+        gf_exp[i] = (uint8_t)x;
+        gf_log[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11D;
+    }
+    for (int i = 255; i < 512; ++i)
+        gf_exp[i] = gf_exp[i - 255];
+
+    for (int a = 0; a < 256; ++a)
+    {
+        for (int b = 0; b < 256; ++b)
+            gf_mul_table[a][b] = (a && b) ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+    }
+}
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    return gf_mul_table[a][b];
+}
+
+static inline uint8_t gf_inv(uint8_t a)
+{
+    return gf_exp[255 - gf_log[a]]; /* a != 0 */
+}
+
+/* ---------- region kernels: dst ^= c * src ---------- */
+
+static void mul_add_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    const uint8_t *row = gf_mul_table[c];
+    for (size_t i = 0; i < len; ++i)
+        dst[i] ^= row[src[i]];
+}
+
+#ifdef RS_HAVE_X86_SIMD
+static int ssse3_available(void)
+{
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int avx2_available(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+/* c * x = c * (x & 0x0f) ^ c * (x & 0xf0) */
+static void nibble_tables(uint8_t c, uint8_t lo[16], uint8_t hi[16])
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        lo[i] = gf_mul(c, (uint8_t)i);
+        hi[i] = gf_mul(c, (uint8_t)(i << 4));
+    }
+}
+
+__attribute__((target("ssse3"))) static size_t mul_add_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    const __m128i tlo = _mm_loadu_si128((const __m128i *)lo);
+    const __m128i thi = _mm_loadu_si128((const __m128i *)hi);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i l = _mm_and_si128(x, mask);
+        __m128i h = _mm_and_si128(_mm_srli_epi64(x, 4), mask);
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, l), _mm_shuffle_epi8(thi, h));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t mul_add_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    const __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    const __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        __m256i p0 = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x0, mask)),
+                                      _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x0, 4), mask)));
+        __m256i p1 = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x1, mask)),
+                                      _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x1, 4), mask)));
+        __m256i d0 = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i d1 = _mm256_loadu_si256((const __m256i *)(dst + i + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d0, p0));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_xor_si256(d1, p1));
+    }
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask)),
+                                     _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, p));
+    }
+    return i;
+}
+#endif
+
+typedef size_t (*mul_add_fn)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+static mul_add_fn pick_kernel(void)
+{
+#ifdef RS_HAVE_X86_SIMD
+    if (avx2_available())
+        return mul_add_avx2;
+    if (ssse3_available())
+        return mul_add_ssse3;
+#endif
+    return NULL;
+}
+
+static void mul_add_region(mul_add_fn simd, uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if (c == 0)
+        return;
+    size_t done = 0;
+    if (c == 1)
+    {
+        for (; done < len; ++done)
+            dst[done] ^= src[done];
+        return;
+    }
+    if (simd)
+        done = simd(dst, src, c, len);
+    mul_add_scalar(dst + done, src + done, c, len - done);
+}
+
+/* out[j] = sum_i coef[j][i] * in[i] over len bytes, for nout outputs and
+ * nin inputs; coef is row-major nout x nin. */
+static void matrix_apply(const uint8_t *coef, size_t nout, size_t nin, size_t len,
+                         const unsigned char *const *in, unsigned char *const *out)
+{
+    mul_add_fn simd = pick_kernel();
+    for (size_t j = 0; j < nout; ++j)
+        memset(out[j], 0, len);
+    for (size_t off = 0; off < len; off += RS_BLOCK)
+    {
+        size_t n = len - off < RS_BLOCK ? len - off : RS_BLOCK;
+        for (size_t i = 0; i < nin; ++i)
+        {
+            for (size_t j = 0; j < nout; ++j)
+                mul_add_region(simd, out[j] + off, in[i] + off, coef[j * nin + i], n);
+        }
+    }
+}
+
+static uint8_t cauchy(size_t k, size_t r, size_t c)
+{
+    return gf_inv((uint8_t)((k + r) ^ c));
+}
+
+int rs_encode(size_t k, size_t m, size_t len, const unsigned char *const *data, unsigned char *const *parity)
+{
+    if (k == 0 || k + m > RS_MAX_SHARDS || !data || (m && !parity))
+        return -1;
+    if (m == 0)
+        return 0;
+    pthread_once(&gf_once, gf_init);
+
+    uint8_t *coef = malloc(m * k);
+    if (!coef)
+        return -4;
+    for (size_t r = 0; r < m; ++r)
+    {
+        for (size_t c = 0; c < k; ++c)
+            coef[r * k + c] = cauchy(k, r, c);
+    }
+    matrix_apply(coef, m, k, len, data, parity);
+    free(coef);
+    return 0;
+}
+
+/* Invert the k x k matrix a in place (Gauss-Jordan). */
+static int gf_invert(uint8_t *a, size_t k)
+{
+    uint8_t *inv = calloc(k * k, 1);
+    if (!inv)
+        return -4;
+    for (size_t i = 0; i < k; ++i)
+        inv[i * k + i] = 1;
+
+    for (size_t col = 0; col < k; ++col)
+    {
+        size_t piv = col;
+        while (piv < k && a[piv * k + col] == 0)
+            ++piv;
+        if (piv == k)
+        {
+            free(inv);
+            return -3; /* singular: cannot happen for a Cauchy code */
+        }
+        if (piv != col)
+        {
+            for (size_t j = 0; j < k; ++j)
+            {
+                uint8_t t = a[col * k + j];
+                a[col * k + j] = a[piv * k + j];
+                a[piv * k + j] = t;
+                t = inv[col * k + j];
+                inv[col * k + j] = inv[piv * k + j];
+                inv[piv * k + j] = t;
+            }
+        }
+        uint8_t s = gf_inv(a[col * k + col]);
+        for (size_t j = 0; j < k; ++j)
+        {
+            a[col * k + j] = gf_mul(a[col * k + j], s);
+            inv[col * k + j] = gf_mul(inv[col * k + j], s);
+        }
+        for (size_t row = 0; row < k; ++row)
+        {
+            uint8_t f = a[row * k + col];
+            if (row == col || f == 0)
+                continue;
+            for (size_t j = 0; j < k; ++j)
+            {
+                a[row * k + j] ^= gf_mul(f, a[col * k + j]);
+                inv[row * k + j] ^= gf_mul(f, inv[col * k + j]);
+            }
+        }
+    }
+    memcpy(a, inv, k * k);
+    free(inv);
+    return 0;
+}
+
+int rs_reconstruct(size_t k, size_t m, size_t len, unsigned char *const *shards, const int *present)
+{
+    if (k == 0 || k + m > RS_MAX_SHARDS || !shards || !present)
+        return -1;
+    pthread_once(&gf_once, gf_init);
+
+    /* Pick k present shards, data shards first (their rows are trivial) */
+    size_t rows[RS_MAX_SHARDS];
+    size_t nrows = 0;
+    size_t missing[RS_MAX_SHARDS];
+    size_t nmissing = 0;
+    for (size_t i = 0; i < k; ++i)
+    {
+        if (present[i])
+            rows[nrows++] = i;
+        else
+            missing[nmissing++] = i;
+    }
+    if (nmissing == 0)
+        return 0;
+    for (size_t i = k; i < k + m && nrows < k; ++i)
+    {
+        if (present[i])
+            rows[nrows++] = i;
+    }
+    if (nrows < k)
+        return -3;
+
+    /* Rows of the code matrix for the chosen shards, inverted: data = A^-1 * chosen */
+    uint8_t *a = calloc(k * k, 1);
+    uint8_t *coef = malloc(nmissing * k);
+    const unsigned char **in = malloc(k * sizeof(*in));
+    unsigned char **out = malloc(nmissing * sizeof(*out));
+    int rc = (a && coef && in && out) ? 0 : -4;
+    if (rc == 0)
+    {
+        for (size_t r = 0; r < k; ++r)
+        {
+            if (rows[r] < k)
+                a[r * k + rows[r]] = 1;
+            else
+            {
+                for (size_t c = 0; c < k; ++c)
+                    a[r * k + c] = cauchy(k, rows[r] - k, c);
+            }
+            in[r] = shards[rows[r]];
+        }
+        rc = gf_invert(a, k);
+    }
+    if (rc == 0)
+    {
+        for (size_t j = 0; j < nmissing; ++j)
+        {
+            memcpy(coef + j * k, a + missing[j] * k, k);
+            out[j] = shards[missing[j]];
+        }
+        matrix_apply(coef, nmissing, k, len, in, out);
+    }
+    free(a);
+    free(coef);
+    free(in);
+    free(out);
+    return rc;
+}
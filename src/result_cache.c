@@ -0,0 +1,452 @@
+/* ==========================================================
+ * result_cache.c - Content-addressed cache of encode results
+ * ==========================================================
+ *
+ * The index of entries (key, size, last use) is kept in memory and built
+ * from the directory when the cache is opened; last use is the entry's
+ * mtime, which a hit bumps, so recency survives between runs. Entries are
+ * published with rename() from a private temporary file and only ever
+ * copied out, never linked, so editing an output in place cannot corrupt
+ * the cache. Another process evicting an entry just turns a hit into a
+ * miss.
+ */
+
+#define _GNU_SOURCE /* copy_file_range() */
+
+#include "../include/result_cache.h"
+#include "../include/aes_wrapper.h"
+#include "../include/metadata.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+/* Bump whenever the embedder's output for the same inputs changes */
+#define RESULT_CACHE_FORMAT "stego-result-cache-1"
+
+#define RESULT_CACHE_IO_CHUNK (1024 * 1024)
+
+struct cache_entry
+{
+    unsigned char key[RESULT_CACHE_KEY_LEN];
+    uint64_t size;
+    int64_t last_use; /* ns since the epoch */
+};
+
+struct ResultCache
+{
+    char *dir;
+    uint64_t max_bytes;
+    uint64_t total;
+    struct cache_entry *entries;
+    size_t count;
+    size_t cap;
+    pthread_mutex_t lock;
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void key_to_hex(const unsigned char key[RESULT_CACHE_KEY_LEN], char hex[2 * RESULT_CACHE_KEY_LEN + 1])
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < RESULT_CACHE_KEY_LEN; ++i)
+    {
+        hex[2 * i] = digits[key[i] >> 4];
+        hex[2 * i + 1] = digits[key[i] & 0x0f];
+    }
+    hex[2 * RESULT_CACHE_KEY_LEN] = '\0';
+}
+
+static int hex_to_key(const char *hex, unsigned char key[RESULT_CACHE_KEY_LEN])
+{
+    for (size_t i = 0; i < 2 * RESULT_CACHE_KEY_LEN; ++i)
+    {
+        char c = hex[i];
+        int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (v < 0)
+            return -1;
+        if (i % 2 == 0)
+            key[i / 2] = (unsigned char)(v << 4);
+        else
+            key[i / 2] |= (unsigned char)v;
+    }
+    return 0;
+}
+
+static void entry_path(const struct ResultCache *cache, const unsigned char key[RESULT_CACHE_KEY_LEN],
+                       char *buf, size_t len)
+{
+    char hex[2 * RESULT_CACHE_KEY_LEN + 1];
+    key_to_hex(key, hex);
+    snprintf(buf, len, "%s/%s.png", cache->dir, hex);
+}
+
+/* ---------- index (call with the lock held) ---------- */
+
+static struct cache_entry *find_entry(struct ResultCache *cache, const unsigned char key[RESULT_CACHE_KEY_LEN])
+{
+    for (size_t i = 0; i < cache->count; ++i)
+    {
+        if (memcmp(cache->entries[i].key, key, RESULT_CACHE_KEY_LEN) == 0)
+            return &cache->entries[i];
+    }
+    return NULL;
+}
+
+static void drop_entry(struct ResultCache *cache, struct cache_entry *e)
+{
+    cache->total -= e->size;
+    *e = cache->entries[--cache->count];
+}
+
+static int add_entry(struct ResultCache *cache, const unsigned char key[RESULT_CACHE_KEY_LEN],
+                     uint64_t size, int64_t last_use)
+{
+    struct cache_entry *e = find_entry(cache, key);
+    if (!e)
+    {
+        if (cache->count == cache->cap)
+        {
+            size_t cap = cache->cap ? cache->cap * 2 : 64;
+            struct cache_entry *grown = realloc(cache->entries, cap * sizeof(*grown));
+            if (!grown)
+                return -4;
+            cache->entries = grown;
+            cache->cap = cap;
+        }
+        e = &cache->entries[cache->count++];
+        memcpy(e->key, key, RESULT_CACHE_KEY_LEN);
+        e->size = 0;
+    }
+    cache->total = cache->total - e->size + size;
+    e->size = size;
+    e->last_use = last_use;
+    return 0;
+}
+
+/* Delete least recently used entries until the total fits, sparing keep. */
+static void evict(struct ResultCache *cache, const unsigned char *keep)
+{
+    while (cache->total > cache->max_bytes)
+    {
+        struct cache_entry *oldest = NULL;
+        for (size_t i = 0; i < cache->count; ++i)
+        {
+            struct cache_entry *e = &cache->entries[i];
+            if (keep && memcmp(e->key, keep, RESULT_CACHE_KEY_LEN) == 0)
+                continue;
+            if (!oldest || e->last_use < oldest->last_use)
+                oldest = e;
+        }
+        if (!oldest)
+            break;
+        char path[4096];
+        entry_path(cache, oldest->key, path, sizeof(path));
+        unlink(path);
+        drop_entry(cache, oldest);
+    }
+}
+
+/* ---------- file helpers ---------- */
+
+/* Copy the whole of src_fd into dst_fd: a reflink if the filesystem can,
+ * else an in-kernel copy, else read/write. */
+static int copy_fd(int src_fd, int dst_fd)
+{
+#ifdef FICLONE
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+        return 0;
+#endif
+    ssize_t n;
+    while ((n = copy_file_range(src_fd, NULL, dst_fd, NULL, RESULT_CACHE_IO_CHUNK, 0)) > 0)
+        ;
+    if (n == 0)
+        return 0;
+    if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+        return -2;
+
+    /* start over with plain read/write */
+    if (lseek(src_fd, 0, SEEK_SET) < 0 || ftruncate(dst_fd, 0) != 0 || lseek(dst_fd, 0, SEEK_SET) < 0)
+        return -2;
+    unsigned char *buf = malloc(RESULT_CACHE_IO_CHUNK);
+    if (!buf)
+        return -4;
+    int rc = 0;
+    while (rc == 0 && (n = read(src_fd, buf, RESULT_CACHE_IO_CHUNK)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno != EINTR)
+                rc = -2;
+            continue;
+        }
+        for (ssize_t off = 0; rc == 0 && off < n;)
+        {
+            ssize_t w = write(dst_fd, buf + off, (size_t)(n - off));
+            if (w < 0 && errno != EINTR)
+                rc = -2;
+            else if (w > 0)
+                off += w;
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+/* Copy src to dst through a temporary file beside dst and rename() it
+ * into place, so dst is either the old file or a complete copy. */
+static int copy_file_atomic(const char *src, const char *dst, uint64_t *size_out)
+{
+    int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+    if (src_fd < 0)
+        return errno == ENOENT ? 1 : -2;
+
+    char tmp[4096];
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", dst) >= sizeof(tmp))
+    {
+        close(src_fd);
+        return -1;
+    }
+    int dst_fd = mkstemp(tmp);
+    if (dst_fd < 0)
+    {
+        close(src_fd);
+        return -2;
+    }
+
+    struct stat st;
+    int rc = copy_fd(src_fd, dst_fd);
+    if (rc == 0 && fstat(dst_fd, &st) != 0)
+        rc = -2;
+    if (rc == 0 && size_out)
+        *size_out = (uint64_t)st.st_size;
+    /* mkstemp() files are 0600; keep the source's permissions instead */
+    struct stat src_st;
+    if (rc == 0 && fstat(src_fd, &src_st) == 0)
+        fchmod(dst_fd, src_st.st_mode & 0777);
+    if (close(dst_fd) != 0 && rc == 0)
+        rc = -2;
+    close(src_fd);
+    if (rc == 0 && rename(tmp, dst) != 0)
+        rc = -2;
+    if (rc != 0)
+        unlink(tmp);
+    return rc;
+}
+
+/* ---------- public API ---------- */
+
+int result_cache_default_dir(char *buf, size_t len)
+{
+    const char *env = getenv("STEGO_CACHE_DIR");
+    if (env && env[0])
+        return (size_t)snprintf(buf, len, "%s", env) < len ? 0 : -1;
+    env = getenv("XDG_CACHE_HOME");
+    if (env && env[0])
+        return (size_t)snprintf(buf, len, "%s/stego-c-practice", env) < len ? 0 : -1;
+    env = getenv("HOME");
+    if (env && env[0])
+        return (size_t)snprintf(buf, len, "%s/.cache/stego-c-practice", env) < len ? 0 : -1;
+    return -1;
+}
+
+/* Create dir and any missing parents. */
+static int make_dirs(const char *dir)
+{
+    char path[4096];
+    if ((size_t)snprintf(path, sizeof(path), "%s", dir) >= sizeof(path))
+        return -1;
+    for (char *p = path + 1; *p; ++p)
+    {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(path, 0700) != 0 && errno != EEXIST)
+            return -2;
+        *p = '/';
+    }
+    if (mkdir(path, 0700) != 0 && errno != EEXIST)
+        return -2;
+    return 0;
+}
+
+int result_cache_open(const char *dir, uint64_t max_bytes, struct ResultCache **out)
+{
+    if (!dir || !out)
+        return -1;
+    if (make_dirs(dir) != 0)
+        return -2;
+    DIR *d = opendir(dir);
+    if (!d)
+        return -2;
+
+    struct ResultCache *cache = calloc(1, sizeof(*cache));
+    if (!cache || !(cache->dir = strdup(dir)))
+    {
+        free(cache);
+        closedir(d);
+        return -4;
+    }
+    cache->max_bytes = max_bytes;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL)
+    {
+        unsigned char key[RESULT_CACHE_KEY_LEN];
+        if (strlen(de->d_name) != 2 * RESULT_CACHE_KEY_LEN + 4 ||
+            strcmp(de->d_name + 2 * RESULT_CACHE_KEY_LEN, ".png") != 0 ||
+            hex_to_key(de->d_name, key) != 0)
+            continue;
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        if (add_entry(cache, key, (uint64_t)st.st_size, mtime) != 0)
+            break;
+    }
+    closedir(d);
+    evict(cache, NULL);
+
+    *out = cache;
+    return 0;
+}
+
+void result_cache_close(struct ResultCache *cache)
+{
+    if (!cache)
+        return;
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->dir);
+    free(cache);
+}
+
+static int hash_file(struct AesSha256Ctx *ctx, const char *path, unsigned char *buf)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -2;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -2;
+    }
+    /* length first, so adjacent inputs cannot run into each other */
+    uint64_t len = (uint64_t)st.st_size;
+    aes_sha256_update(ctx, &len, sizeof(len));
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    uint64_t seen = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, RESULT_CACHE_IO_CHUNK)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return -2;
+        }
+        aes_sha256_update(ctx, buf, (size_t)n);
+        seen += (uint64_t)n;
+    }
+    close(fd);
+    return seen == len ? 0 : -2; /* changed while hashing */
+}
+
+int result_cache_key(const char *cover_path, const char *payload_path, const char *payload_name,
+                     int lsb_depth, int compression, struct ResultCacheKey *key)
+{
+    if (!cover_path || !payload_path || !payload_name || !key)
+        return -1;
+    unsigned char *buf = malloc(RESULT_CACHE_IO_CHUNK);
+    if (!buf)
+        return -4;
+
+    struct AesSha256Ctx ctx;
+    aes_sha256_init(&ctx);
+    aes_sha256_update(&ctx, RESULT_CACHE_FORMAT, sizeof(RESULT_CACHE_FORMAT));
+    int32_t params[3] = {METADATA_VERSION_CURRENT, lsb_depth, compression};
+    aes_sha256_update(&ctx, params, sizeof(params));
+    aes_sha256_update(&ctx, payload_name, strlen(payload_name) + 1);
+
+    int rc = hash_file(&ctx, cover_path, buf);
+    if (rc == 0)
+        rc = hash_file(&ctx, payload_path, buf);
+    free(buf);
+    if (rc == 0)
+        aes_sha256_final(&ctx, key->digest);
+    return rc;
+}
+
+int result_cache_fetch(struct ResultCache *cache, const struct ResultCacheKey *key, const char *out_path)
+{
+    if (!cache || !key || !out_path)
+        return -1;
+
+    pthread_mutex_lock(&cache->lock);
+    int known = find_entry(cache, key->digest) != NULL;
+    pthread_mutex_unlock(&cache->lock);
+    if (!known)
+        return 1;
+
+    char path[4096];
+    entry_path(cache, key->digest, path, sizeof(path));
+    int rc = copy_file_atomic(path, out_path, NULL);
+
+    pthread_mutex_lock(&cache->lock);
+    struct cache_entry *e = find_entry(cache, key->digest);
+    if (rc == 1 && e)
+        drop_entry(cache, e); /* evicted by another process */
+    else if (rc == 0 && e)
+    {
+        e->last_use = now_ns();
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return rc;
+}
+
+int result_cache_store(struct ResultCache *cache, const struct ResultCacheKey *key, const char *out_path)
+{
+    if (!cache || !key || !out_path)
+        return -1;
+
+    struct stat st;
+    if (stat(out_path, &st) != 0)
+        return -2;
+    if ((uint64_t)st.st_size > cache->max_bytes)
+        return 0; /* would evict everything else and then itself */
+
+    char path[4096];
+    entry_path(cache, key->digest, path, sizeof(path));
+    uint64_t size = 0;
+    int rc = copy_file_atomic(out_path, path, &size);
+    if (rc != 0)
+        return rc < 0 ? rc : -2;
+
+    pthread_mutex_lock(&cache->lock);
+    rc = add_entry(cache, key->digest, size, now_ns());
+    evict(cache, key->digest);
+    pthread_mutex_unlock(&cache->lock);
+    return rc;
+}
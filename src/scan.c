@@ -0,0 +1,274 @@
+/* ==========================================================
+ * scan.c - Parallel search of a directory tree for stego images
+ * ==========================================================
+ *
+ * The caller's thread walks the tree and feeds a bounded queue of opened
+ * files; workers take files off the queue and probe them with
+ * stego_read_metadata_stream(). Opening a file on the walker side lets
+ * it start the kernel readahead (posix_fadvise) for the bytes a probe
+ * needs while earlier files are still being decoded, and the queue depth
+ * caps both the memory and the descriptors in flight.
+ */
+
+#include "../include/scan.h"
+#include "../include/stego_core.h"
+#include "../include/metadata.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define SCAN_MAX_THREADS 64
+#define SCAN_QUEUE_DEPTH 256         /* files opened ahead of the workers */
+#define SCAN_READAHEAD (64 * 1024)   /* enough for the top rows of most images */
+
+struct scan_item
+{
+    int fd;
+    char *path;
+};
+
+struct scan_ctx
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct scan_item items[SCAN_QUEUE_DEPTH];
+    size_t head;
+    size_t count;
+    bool done; /* walker finished, drain and exit */
+
+    pthread_mutex_t report_lock;
+    scan_hit_fn on_hit;
+    void *hit_ctx;
+
+    uint64_t files;
+    atomic_uint_fast64_t images;
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t errors;
+};
+
+/* ---------- queue ---------- */
+
+static void queue_push(struct scan_ctx *s, struct scan_item item)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->count == SCAN_QUEUE_DEPTH)
+        pthread_cond_wait(&s->not_full, &s->lock);
+    s->items[(s->head + s->count) % SCAN_QUEUE_DEPTH] = item;
+    ++s->count;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* false once the walker is done and the queue is empty */
+static bool queue_pop(struct scan_ctx *s, struct scan_item *item)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->count == 0 && !s->done)
+        pthread_cond_wait(&s->not_empty, &s->lock);
+    bool got = s->count > 0;
+    if (got)
+    {
+        *item = s->items[s->head];
+        s->head = (s->head + 1) % SCAN_QUEUE_DEPTH;
+        --s->count;
+        pthread_cond_signal(&s->not_full);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return got;
+}
+
+/* ---------- workers ---------- */
+
+static void probe_one(struct scan_ctx *s, struct scan_item *item)
+{
+    FILE *f = fdopen(item->fd, "rb");
+    if (!f)
+    {
+        close(item->fd);
+        atomic_fetch_add(&s->errors, 1);
+        return;
+    }
+
+    /* Only formats that keep LSBs intact are worth decoding: PNG starts
+     * with 0x89, BMP with 'B' (the loader checks the rest) */
+    int c = fgetc(f);
+    if (c == 0x89 || c == 'B')
+    {
+        ungetc(c, f);
+        atomic_fetch_add(&s->images, 1);
+
+        struct Metadata meta;
+        if (stego_read_metadata_stream(f, &meta) == 0)
+        {
+            atomic_fetch_add(&s->hits, 1);
+            if (s->on_hit)
+            {
+                pthread_mutex_lock(&s->report_lock);
+                s->on_hit(s->hit_ctx, item->path, &meta);
+                pthread_mutex_unlock(&s->report_lock);
+            }
+        }
+    }
+    fclose(f);
+}
+
+static void *scan_worker(void *arg)
+{
+    struct scan_ctx *s = arg;
+    struct scan_item item;
+    while (queue_pop(s, &item))
+    {
+        probe_one(s, &item);
+        free(item.path);
+    }
+    return NULL;
+}
+
+/* ---------- walker ---------- */
+
+static void enqueue_file(struct scan_ctx *s, char *path)
+{
+    ++s->files;
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd < 0)
+    {
+        atomic_fetch_add(&s->errors, 1);
+        free(path);
+        return;
+    }
+    posix_fadvise(fd, 0, SCAN_READAHEAD, POSIX_FADV_WILLNEED);
+    queue_push(s, (struct scan_item){fd, path});
+}
+
+static int walk(struct scan_ctx *s, const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+        return -2;
+
+    size_t dir_len = strlen(dir_path);
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        size_t name_len = strlen(de->d_name);
+        char *path = malloc(dir_len + name_len + 2);
+        if (!path)
+        {
+            atomic_fetch_add(&s->errors, 1);
+            continue;
+        }
+        memcpy(path, dir_path, dir_len);
+        path[dir_len] = '/';
+        memcpy(path + dir_len + 1, de->d_name, name_len + 1);
+
+        /* d_type saves a stat per entry; not every filesystem fills it */
+        bool is_dir = de->d_type == DT_DIR;
+        bool is_reg = de->d_type == DT_REG;
+        struct stat st;
+        if (de->d_type == DT_UNKNOWN && lstat(path, &st) == 0)
+        {
+            is_dir = S_ISDIR(st.st_mode);
+            is_reg = S_ISREG(st.st_mode);
+        }
+
+        if (is_dir)
+        {
+            if (walk(s, path) != 0)
+                atomic_fetch_add(&s->errors, 1);
+            free(path);
+        }
+        else if (is_reg)
+        {
+            enqueue_file(s, path); /* takes ownership of path */
+        }
+        else
+        {
+            free(path);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+/* ---------- public API ---------- */
+
+int stego_scan_dir(const char *root, size_t threads, scan_hit_fn on_hit, void *ctx, struct ScanStats *stats)
+{
+    if (!root)
+        return -1;
+
+    DIR *probe = opendir(root);
+    if (!probe)
+        return -2;
+    closedir(probe);
+
+    if (threads == 0)
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = ncpu > 0 ? (size_t)ncpu : 1;
+    }
+    if (threads > SCAN_MAX_THREADS)
+        threads = SCAN_MAX_THREADS;
+
+    struct scan_ctx *s = calloc(1, sizeof(*s));
+    if (!s)
+        return -5;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->not_empty, NULL);
+    pthread_cond_init(&s->not_full, NULL);
+    pthread_mutex_init(&s->report_lock, NULL);
+    s->on_hit = on_hit;
+    s->hit_ctx = ctx;
+
+    pthread_t tids[SCAN_MAX_THREADS];
+    size_t started = 0;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        if (pthread_create(&tids[started], NULL, scan_worker, s) == 0)
+            ++started;
+    }
+
+    int rc = 0;
+    if (started == 0)
+    {
+        rc = -5;
+    }
+    else
+    {
+        walk(s, root);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->done = true;
+    pthread_cond_broadcast(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+    for (size_t t = 0; t < started; ++t)
+        pthread_join(tids[t], NULL);
+
+    if (stats)
+    {
+        stats->files = s->files;
+        stats->images = atomic_load(&s->images);
+        stats->hits = atomic_load(&s->hits);
+        stats->errors = atomic_load(&s->errors);
+    }
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->not_empty);
+    pthread_cond_destroy(&s->not_full);
+    pthread_mutex_destroy(&s->report_lock);
+    free(s);
+    return rc;
+}
@@ -0,0 +1,738 @@
+/* ==========================================================
+ * shard.c - Sharding one payload across several cover images
+ * ==========================================================
+ *
+ * Only the public stego_core API is used: each shard is an ordinary
+ * stego_embed() of a slice of the payload with the shard fields set in its
+ * metadata, and decoding reads the slices back through StegoReader
+ * straight into the reassembled buffer. Work is spread over a small pool
+ * of threads pulling shard indices from an atomic counter; image loading
+ * and PNG encoding, which dominate, run in the same pool.
+ *
+ * Erasure-coded sets cut the payload into data_shards equal stripes and
+ * add Reed-Solomon parity stripes, one stripe per image. The coding is
+ * split by byte range across the same pool; each range is an independent
+ * code over the same columns of every stripe.
+ */
+
+#include "../include/shard.h"
+#include "../include/stego_core.h"
+#include "../include/metadata.h"
+#include "../include/payload.h"
+#include "../include/image_io.h"
+#include "../include/compress.h"
+#include "../include/crc32c.h"
+#include "../include/reed_solomon.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define SHARD_MAX_THREADS 64
+#define SHARD_CODE_CHUNK (1024 * 1024) /* smallest byte range coded by one job */
+
+/* ---------- parallel for ---------- */
+
+typedef void (*shard_job_fn)(void *ctx, size_t i);
+
+struct shard_pool
+{
+    shard_job_fn fn;
+    void *ctx;
+    size_t count;
+    atomic_size_t next;
+};
+
+static void *shard_worker(void *arg)
+{
+    struct shard_pool *pool = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count)
+        pool->fn(pool->ctx, i);
+    return NULL;
+}
+
+/* Run fn(ctx, i) for i in [0, count) on up to one thread per core. The
+ * calling thread takes part, so a failed pthread_create only costs speed. */
+static void shard_parallel_for(size_t count, shard_job_fn fn, void *ctx)
+{
+    struct shard_pool pool = {fn, ctx, count, 0};
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = ncpu > 0 ? (size_t)ncpu : 1;
+    if (nthreads > SHARD_MAX_THREADS)
+        nthreads = SHARD_MAX_THREADS;
+    if (nthreads > count)
+        nthreads = count;
+
+    pthread_t tids[SHARD_MAX_THREADS];
+    int started[SHARD_MAX_THREADS] = {0};
+    for (size_t t = 1; t < nthreads; ++t)
+        started[t] = pthread_create(&tids[t], NULL, shard_worker, &pool) == 0;
+
+    shard_worker(&pool);
+    for (size_t t = 1; t < nthreads; ++t)
+    {
+        if (started[t])
+            pthread_join(tids[t], NULL);
+    }
+}
+
+static uint64_t random_payload_id(void)
+{
+    uint64_t id = 0;
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        if (read(fd, &id, sizeof(id)) != (ssize_t)sizeof(id))
+            id = 0;
+        close(fd);
+    }
+    if (id == 0)
+    {
+        /* not secret, only needs to tell payloads apart */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        id = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+    }
+    return id;
+}
+
+/* ---------- embedding ---------- */
+
+struct embed_job
+{
+    const struct Image *covers;
+    struct Image *outs;
+    const struct Payload *payload;
+    unsigned char *const *stripes; /* coded sets: one buffer per shard */
+    struct Metadata *metas;         /* one per shard */
+    int lsb_depth;
+    int *rcs;
+};
+
+static void embed_one(void *ctx, size_t i)
+{
+    struct embed_job *job = ctx;
+    unsigned char *src = job->stripes ? job->stripes[i] : job->payload->data + job->metas[i].shard_offset;
+    struct Payload slice = {src, (size_t)job->metas[i].file_size, 0, 0};
+    job->rcs[i] = stego_embed(&job->covers[i], &slice, &job->metas[i], job->lsb_depth, &job->outs[i]);
+}
+
+/* Bytes of each cover taken by the length prefix and metadata record.
+ * Serialized with the largest field values so varints cannot outgrow it. */
+static int shard_overhead(const struct Metadata *tmpl, size_t *out)
+{
+    struct Metadata m = *tmpl;
+    m.has_crc = true;
+    m.file_size = m.total_size;
+    m.shard_index = m.shard_count - 1;
+    m.shard_offset = m.total_size;
+    unsigned char *buf = NULL;
+    size_t len = 0;
+    if (metadata_serialize(&m, &buf, &len) != 0)
+        return -3;
+    free(buf);
+    *out = 4 + len;
+    return 0;
+}
+
+int stego_embed_sharded(const struct Image *covers, size_t count,
+                        const struct Payload *payload, const struct Metadata *meta,
+                        int lsb_depth, struct Image *outs)
+{
+    if (!covers || !payload || !meta || !outs || count == 0 || (!payload->data && payload->size))
+        return -1;
+    if (count > METADATA_MAX_SHARDS || meta->version == METADATA_VERSION_1)
+        return -1;
+
+    struct Metadata tmpl = *meta;
+    tmpl.sharded = true;
+    tmpl.payload_id = random_payload_id();
+    tmpl.shard_count = (uint32_t)count;
+    tmpl.data_shards = (uint32_t)count;
+    tmpl.total_size = payload->size;
+
+    size_t overhead = 0;
+    if (shard_overhead(&tmpl, &overhead) != 0)
+        return -3;
+
+    struct Metadata *metas = calloc(count, sizeof(*metas));
+    size_t *usable = calloc(count, sizeof(*usable));
+    int *rcs = calloc(count, sizeof(*rcs));
+    if (!metas || !usable || !rcs)
+    {
+        free(metas);
+        free(usable);
+        free(rcs);
+        return -4;
+    }
+
+    /* Split in proportion to capacity so every cover does a similar share
+     * of the work, then hand out what rounding left over. */
+    uint64_t total_usable = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t cap = stego_capacity_bytes(&covers[i], lsb_depth);
+        usable[i] = cap > overhead ? cap - overhead : 0;
+        total_usable += usable[i];
+    }
+    int rc = 0;
+    if (payload->size > total_usable)
+        rc = -5;
+
+    uint64_t assigned = 0;
+    for (size_t i = 0; rc == 0 && i < count; ++i)
+    {
+        uint64_t share = (uint64_t)((long double)payload->size * usable[i] / (long double)total_usable);
+        if (share > usable[i])
+            share = usable[i];
+        metas[i] = tmpl;
+        metas[i].file_size = share;
+        assigned += share;
+    }
+    for (size_t i = 0; rc == 0 && i < count && assigned < payload->size; ++i)
+    {
+        uint64_t room = usable[i] - metas[i].file_size;
+        uint64_t add = payload->size - assigned < room ? payload->size - assigned : room;
+        metas[i].file_size += add;
+        assigned += add;
+    }
+    uint64_t offset = 0;
+    for (size_t i = 0; rc == 0 && i < count; ++i)
+    {
+        metas[i].shard_index = (uint32_t)i;
+        metas[i].shard_offset = offset;
+        offset += metas[i].file_size;
+    }
+
+    if (rc == 0)
+    {
+        memset(outs, 0, count * sizeof(*outs));
+        struct embed_job job = {covers, outs, payload, NULL, metas, lsb_depth, rcs};
+        shard_parallel_for(count, embed_one, &job);
+        for (size_t i = 0; i < count && rc == 0; ++i)
+            rc = rcs[i];
+        if (rc != 0)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (rcs[i] == 0)
+                    image_free(&outs[i]);
+            }
+        }
+    }
+
+    free(metas);
+    free(usable);
+    free(rcs);
+    return rc;
+}
+
+/* ---------- erasure coding ---------- */
+
+struct code_job
+{
+    size_t k, m;
+    size_t len;   /* stripe length */
+    size_t chunk; /* bytes per job */
+    unsigned char **stripes;
+    const int *present; /* NULL: encode */
+    int *rcs;
+};
+
+static void code_one(void *ctx, size_t i)
+{
+    struct code_job *job = ctx;
+    size_t off = i * job->chunk;
+    size_t len = job->len - off < job->chunk ? job->len - off : job->chunk;
+
+    unsigned char *cols[METADATA_MAX_CODED_SHARDS];
+    for (size_t s = 0; s < job->k + job->m; ++s)
+        cols[s] = job->stripes[s] ? job->stripes[s] + off : NULL;
+    if (job->present)
+        job->rcs[i] = rs_reconstruct(job->k, job->m, len, cols, job->present);
+    else
+        job->rcs[i] = rs_encode(job->k, job->m, len, (const unsigned char *const *)cols, cols + job->k);
+}
+
+/* Encode parity (present == NULL) or rebuild missing data stripes, with
+ * the byte range split across the pool. */
+static int code_parallel(size_t k, size_t m, size_t len, unsigned char **stripes, const int *present)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t jobs = ncpu > 0 ? (size_t)ncpu : 1;
+    if (jobs > SHARD_MAX_THREADS)
+        jobs = SHARD_MAX_THREADS;
+    size_t chunk = (len + jobs - 1) / jobs;
+    if (chunk < SHARD_CODE_CHUNK)
+        chunk = SHARD_CODE_CHUNK;
+    chunk = (chunk + 63) & ~(size_t)63;
+    jobs = len ? (len + chunk - 1) / chunk : 0;
+    if (jobs == 0)
+        return 0;
+
+    int *rcs = calloc(jobs, sizeof(*rcs));
+    if (!rcs)
+        return -4;
+    struct code_job job = {k, m, len, chunk, stripes, present, rcs};
+    shard_parallel_for(jobs, code_one, &job);
+    int rc = 0;
+    for (size_t i = 0; i < jobs && rc == 0; ++i)
+        rc = rcs[i];
+    free(rcs);
+    return rc;
+}
+
+int stego_embed_erasure(const struct Image *covers, size_t count, size_t data_shards,
+                        const struct Payload *payload, const struct Metadata *meta,
+                        int lsb_depth, struct Image *outs)
+{
+    if (!covers || !payload || !meta || !outs || (!payload->data && payload->size))
+        return -1;
+    if (data_shards == 0 || data_shards >= count || count > METADATA_MAX_CODED_SHARDS ||
+        meta->version == METADATA_VERSION_1)
+        return -1;
+
+    size_t k = data_shards;
+    size_t stripe = payload->size / k + (payload->size % k != 0);
+
+    struct Metadata tmpl = *meta;
+    tmpl.sharded = true;
+    tmpl.payload_id = random_payload_id();
+    tmpl.shard_count = (uint32_t)count;
+    tmpl.data_shards = (uint32_t)k;
+    tmpl.total_size = payload->size;
+    tmpl.file_size = stripe;
+    tmpl.shard_offset = 0;
+
+    size_t overhead = 0;
+    if (shard_overhead(&tmpl, &overhead) != 0)
+        return -3;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t cap = stego_capacity_bytes(&covers[i], lsb_depth);
+        if (cap < overhead || cap - overhead < stripe)
+            return -5; /* every image carries a whole stripe */
+    }
+
+    /* Data stripes are the payload, zero padded to k * stripe; the
+     * parity stripes follow in the same buffer. */
+    unsigned char *buf = malloc(stripe ? count * stripe : 1);
+    unsigned char **stripes = malloc(count * sizeof(*stripes));
+    struct Metadata *metas = calloc(count, sizeof(*metas));
+    int *rcs = calloc(count, sizeof(*rcs));
+    int rc = (buf && stripes && metas && rcs) ? 0 : -4;
+    if (rc == 0)
+    {
+        if (payload->size)
+            memcpy(buf, payload->data, payload->size);
+        memset(buf + payload->size, 0, k * stripe - payload->size);
+        for (size_t i = 0; i < count; ++i)
+        {
+            stripes[i] = buf + i * stripe;
+            metas[i] = tmpl;
+            metas[i].shard_index = (uint32_t)i;
+        }
+        rc = code_parallel(k, count - k, stripe, stripes, NULL);
+    }
+
+    if (rc == 0)
+    {
+        memset(outs, 0, count * sizeof(*outs));
+        struct embed_job job = {covers, outs, payload, stripes, metas, lsb_depth, rcs};
+        shard_parallel_for(count, embed_one, &job);
+        for (size_t i = 0; i < count && rc == 0; ++i)
+            rc = rcs[i];
+        if (rc != 0)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (rcs[i] == 0)
+                    image_free(&outs[i]);
+            }
+        }
+    }
+
+    free(buf);
+    free(stripes);
+    free(metas);
+    free(rcs);
+    return rc;
+}
+
+/* ---------- extraction ---------- */
+
+struct extract_job
+{
+    const struct Image *stegos;
+    struct Metadata *metas;
+    struct StegoReader *readers;
+    unsigned char *dst;    /* plain sets: slices land at their offset */
+    unsigned char **dsts;  /* coded sets: per image, NULL to skip */
+    int *rcs;
+};
+
+static void open_one(void *ctx, size_t i)
+{
+    struct extract_job *job = ctx;
+    if (!job->stegos[i].pixels)
+    {
+        job->rcs[i] = -2; /* image failed to load */
+        return;
+    }
+    job->rcs[i] = stego_reader_open(&job->stegos[i], &job->metas[i], &job->readers[i]);
+    if (job->rcs[i] == 0 && !job->metas[i].sharded)
+        job->rcs[i] = -3;
+}
+
+static void read_one(void *ctx, size_t i)
+{
+    struct extract_job *job = ctx;
+    const struct Metadata *m = &job->metas[i];
+    unsigned char *dst = job->dsts ? job->dsts[i] : job->dst + m->shard_offset;
+    if (!dst)
+        return;
+    job->rcs[i] = stego_reader_read(&job->readers[i], 0, dst, (size_t)m->file_size);
+    if (job->rcs[i] == 0 && m->has_crc && crc32c_update(0, dst, (size_t)m->file_size) != m->crc32c)
+        job->rcs[i] = -10;
+}
+
+/* Rebuild an erasure-coded payload from whichever shards of the set
+ * around metas[ref] opened and pass their checksum. Data stripes are read
+ * straight into place; parity is only read if one of them is missing. */
+static int extract_coded(struct extract_job *job, size_t count, size_t ref, unsigned char **data_out)
+{
+    const struct Metadata *r = &job->metas[ref];
+    size_t k = r->data_shards;
+    size_t n = r->shard_count;
+    size_t stripe = (size_t)r->file_size;
+    if (r->total_size > (uint64_t)(size_t)-1 / 2)
+        return -3;
+
+    size_t slot[METADATA_MAX_CODED_SHARDS];
+    int present[METADATA_MAX_CODED_SHARDS] = {0};
+    unsigned char *stripes[METADATA_MAX_CODED_SHARDS] = {0};
+    for (size_t s = 0; s < n; ++s)
+        slot[s] = (size_t)-1;
+    /* Other payloads' shards and duplicates are ignored, not fatal */
+    for (size_t i = 0; i < count; ++i)
+    {
+        const struct Metadata *m = &job->metas[i];
+        if (job->rcs[i] == 0 && m->payload_id == r->payload_id && m->shard_count == n &&
+            m->data_shards == k && m->total_size == r->total_size && slot[m->shard_index] == (size_t)-1)
+            slot[m->shard_index] = i;
+    }
+
+    unsigned char *data = malloc(stripe ? k * stripe : 1);
+    unsigned char *parity = NULL;
+    unsigned char **dsts = calloc(count, sizeof(*dsts));
+    int rc = (data && dsts) ? 0 : -4;
+    int crc_failed = 0;
+    size_t have = 0;
+
+    for (int pass = 0; pass < 2 && rc == 0 && have < k; ++pass)
+    {
+        /* pass 0: data stripes, pass 1: parity */
+        size_t lo = pass ? k : 0;
+        size_t hi = pass ? n : k;
+        if (pass && !(parity = malloc(stripe ? (n - k) * stripe : 1)))
+        {
+            rc = -4;
+            break;
+        }
+        for (size_t s = lo; s < hi; ++s)
+        {
+            stripes[s] = pass ? parity + (s - k) * stripe : data + s * stripe;
+            if (slot[s] != (size_t)-1)
+                dsts[slot[s]] = stripes[s];
+        }
+        job->dsts = dsts;
+        shard_parallel_for(count, read_one, job);
+        for (size_t s = lo; s < hi; ++s)
+        {
+            if (slot[s] == (size_t)-1)
+                continue;
+            dsts[slot[s]] = NULL;
+            if (job->rcs[slot[s]] == 0)
+            {
+                present[s] = 1;
+                ++have;
+            }
+            else if (job->rcs[slot[s]] == -10)
+                crc_failed = 1;
+        }
+    }
+
+    if (rc == 0 && have < k)
+        rc = crc_failed ? -10 : -3;
+    if (rc == 0 && parity)
+        rc = code_parallel(k, n - k, stripe, stripes, present);
+
+    free(parity);
+    free(dsts);
+    job->dsts = NULL;
+    if (rc != 0)
+    {
+        free(data);
+        data = NULL;
+    }
+    *data_out = data;
+    return rc;
+}
+
+/* Read a plain split: exactly one complete set, i.e. the same payload,
+ * every index once, slices contiguous and covering the whole payload. */
+static int extract_plain(struct extract_job *job, size_t count, size_t *first_out, unsigned char **data_out)
+{
+    const struct Metadata *metas = job->metas;
+    size_t *order = malloc(count * sizeof(*order));
+    if (!order)
+        return -4;
+
+    int rc = 0;
+    for (size_t i = 0; i < count && rc == 0; ++i)
+        rc = job->rcs[i];
+    for (size_t i = 0; i < count; ++i)
+        order[i] = (size_t)-1;
+    for (size_t i = 0; i < count && rc == 0; ++i)
+    {
+        const struct Metadata *m = &metas[i];
+        if (m->payload_id != metas[0].payload_id || m->shard_count != count ||
+            m->data_shards != count || m->total_size != metas[0].total_size ||
+            order[m->shard_index] != (size_t)-1)
+            rc = -3;
+        else
+            order[m->shard_index] = i;
+    }
+    uint64_t offset = 0;
+    for (size_t k = 0; k < count && rc == 0; ++k)
+    {
+        const struct Metadata *m = &metas[order[k]];
+        if (m->shard_offset != offset)
+            rc = -3;
+        offset += m->file_size;
+    }
+    if (rc == 0 && (offset != metas[0].total_size || offset > (uint64_t)(size_t)-1))
+        rc = -3;
+
+    unsigned char *data = NULL;
+    if (rc == 0 && !(data = malloc(offset ? (size_t)offset : 1)))
+        rc = -6;
+    if (rc == 0)
+    {
+        job->dst = data;
+        shard_parallel_for(count, read_one, job);
+        for (size_t i = 0; i < count && rc == 0; ++i)
+            rc = job->rcs[i];
+    }
+    if (rc == 0)
+        *first_out = order[0];
+    else
+    {
+        free(data);
+        data = NULL;
+    }
+    free(order);
+    *data_out = data;
+    return rc;
+}
+
+int stego_extract_sharded(const struct Image *stegos, size_t count,
+                          struct Metadata *meta_out, struct Payload *payload_out)
+{
+    if (!stegos || !meta_out || !payload_out || count == 0)
+        return -1;
+
+    struct Metadata *metas = calloc(count, sizeof(*metas));
+    struct StegoReader *readers = calloc(count, sizeof(*readers));
+    int *rcs = calloc(count, sizeof(*rcs));
+    if (!metas || !readers || !rcs)
+    {
+        free(metas);
+        free(readers);
+        free(rcs);
+        return -4;
+    }
+
+    struct extract_job job = {stegos, metas, readers, NULL, NULL, rcs};
+    shard_parallel_for(count, open_one, &job);
+
+    /* The first shard that opened says which kind of set this is; a coded
+     * set tolerates images that are missing, unreadable or damaged. */
+    size_t first = 0;
+    while (first < count && rcs[first] != 0)
+        ++first;
+    unsigned char *data = NULL;
+    int rc;
+    if (first < count && metas[first].data_shards < metas[first].shard_count)
+        rc = extract_coded(&job, count, first, &data);
+    else
+        rc = extract_plain(&job, count, &first, &data);
+
+    if (rc == 0)
+    {
+        *meta_out = metas[first];
+        meta_out->file_size = meta_out->total_size;
+        payload_out->data = data;
+        payload_out->size = (size_t)meta_out->total_size;
+        payload_out->encrypted = meta_out->encrypted;
+        payload_out->map_len = 0;
+
+        /* same contract as stego_extract(): plain payloads come back inflated */
+        if (meta_out->compression && !meta_out->encrypted &&
+            decompress_payload(payload_out, meta_out->compression, (size_t)meta_out->original_size) != 0)
+        {
+            payload_free(payload_out);
+            rc = -9;
+        }
+    }
+
+    free(metas);
+    free(readers);
+    free(rcs);
+    return rc;
+}
+
+/* ---------- file-level helpers ---------- */
+
+struct file_job
+{
+    const char *const *paths;
+    struct Image *images;
+    const char *out_dir;
+    size_t count;
+    int *rcs;
+};
+
+static void load_one(void *ctx, size_t i)
+{
+    struct file_job *job = ctx;
+    job->rcs[i] = image_load(job->paths[i], &job->images[i]);
+}
+
+static void save_one(void *ctx, size_t i)
+{
+    struct file_job *job = ctx;
+    char *copy = strdup(job->paths[i]);
+    if (!copy)
+    {
+        job->rcs[i] = -4;
+        return;
+    }
+    char *stem = basename(copy);
+    char *dot = strrchr(stem, '.');
+    if (dot && dot != stem)
+        *dot = '\0';
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s-%zu-of-%zu.png", job->out_dir, stem, i + 1, job->count);
+    free(copy);
+    job->rcs[i] = image_save(path, &job->images[i]);
+}
+
+/* Load every image in parallel; on failure nothing stays allocated. With
+ * partial set, images that fail to load are left empty (pixels == NULL)
+ * and only a total failure is an error. */
+static int load_all(const char *const *paths, size_t count, bool partial, struct Image **images_out)
+{
+    struct Image *images = calloc(count, sizeof(*images));
+    int *rcs = calloc(count, sizeof(*rcs));
+    if (!images || !rcs)
+    {
+        free(images);
+        free(rcs);
+        return -4;
+    }
+
+    struct file_job job = {paths, images, NULL, count, rcs};
+    shard_parallel_for(count, load_one, &job);
+    int rc = 0;
+    size_t loaded = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (rcs[i] == 0)
+            ++loaded;
+    }
+    if (loaded < count && (!partial || loaded == 0))
+        rc = -2;
+    if (rc != 0)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (rcs[i] == 0)
+                image_free(&images[i]);
+        }
+        free(images);
+        images = NULL;
+    }
+    free(rcs);
+    *images_out = images;
+    return rc;
+}
+
+static void free_all(struct Image *images, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        image_free(&images[i]);
+    free(images);
+}
+
+int shard_encode_files(const char *const *cover_paths, size_t count, size_t data_shards,
+                       const struct Payload *payload, const struct Metadata *meta,
+                       int lsb_depth, const char *out_dir)
+{
+    if (!cover_paths || !out_dir || count == 0)
+        return -1;
+
+    struct Image *covers = NULL;
+    int rc = load_all(cover_paths, count, false, &covers);
+    if (rc != 0)
+        return rc;
+
+    struct Image *outs = calloc(count, sizeof(*outs));
+    int *rcs = calloc(count, sizeof(*rcs));
+    if (!outs || !rcs)
+        rc = -4;
+    if (rc == 0 && data_shards && data_shards < count)
+        rc = stego_embed_erasure(covers, count, data_shards, payload, meta, lsb_depth, outs);
+    else if (rc == 0)
+        rc = stego_embed_sharded(covers, count, payload, meta, lsb_depth, outs);
+    free_all(covers, count);
+
+    if (rc == 0)
+    {
+        struct file_job job = {cover_paths, outs, out_dir, count, rcs};
+        shard_parallel_for(count, save_one, &job);
+        for (size_t i = 0; i < count && rc == 0; ++i)
+            rc = rcs[i] ? -7 : 0;
+        for (size_t i = 0; i < count; ++i)
+            image_free(&outs[i]);
+    }
+    free(outs);
+    free(rcs);
+    return rc;
+}
+
+int shard_decode_files(const char *const *stego_paths, size_t count,
+                       struct Metadata *meta_out, struct Payload *payload_out)
+{
+    if (!stego_paths || count == 0)
+        return -1;
+
+    struct Image *stegos = NULL;
+    int rc = load_all(stego_paths, count, true, &stegos);
+    if (rc != 0)
+        return rc;
+    rc = stego_extract_sharded(stegos, count, meta_out, payload_out);
+    free_all(stegos, count);
+    return rc;
+}
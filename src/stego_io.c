@@ -8,9 +8,10 @@
  * Important notes / TODOs:
  * - Metadata serialization/parsing is delegated to metadata.c via the
  *   functions metadata_serialize() and metadata_parse(). Those must be
- *   implemented to match the format expected here. We expect the
- *   serialized metadata to start with a 4-byte magic 'STEG' followed by
- *   a 4-byte metadata length (big-endian or little-endian consistently).
+ *   implemented to match the format expected here. The embedded stream
+ *   is a 4-byte little-endian metadata length, the serialized metadata
+ *   (compact v2 record, or the legacy 273-byte 'STEG' record) and the
+ *   payload.
  * - Payload memory layout: struct Payload must expose .data and .size.
  * - Batch processing should use GTask in future modules (as requested by
  *   the user). This file is single-threaded and does not depend on pthread.
@@ -30,6 +31,10 @@
 #include "../include/metadata.h"
 #include "../include/payload.h"
 #include "../include/image_io.h"
+#include "../include/compress.h"
+#include "../include/crc32c.h"
+#include "../include/cancel.h"
+#include "../include/progress.h"
 
 /* Forward-declared helper APIs that must be provided in other modules:
  * - metadata_serialize(const Metadata*, unsigned char**, size_t*)
@@ -40,6 +45,13 @@
 int metadata_serialize(const struct Metadata *meta, unsigned char **out_buf, size_t *out_size);
 int metadata_parse(const unsigned char *buf, size_t buf_size, struct Metadata *meta_out);
 
+/* Largest metadata record the decoder will accept */
+#define STEGO_MAX_META_LEN 1024
+
+/* Work between cancellation checks and progress updates: payload bytes
+ * embedded, or pixels read, per check (each a fraction of a millisecond) */
+#define STEGO_CANCEL_BLOCK (64 * 1024)
+
 /* Expectation for Image struct; image_io.c must follow this layout */
 static size_t compute_capacity_bytes(const struct Image *img, int lsb_depth)
 {
@@ -50,6 +62,11 @@ static size_t compute_capacity_bytes(const struct Image *img, int lsb_depth)
     return total_bits / 8;
 }
 
+size_t stego_capacity_bytes(const struct Image *img, int lsb_depth)
+{
+    return compute_capacity_bytes(img, lsb_depth);
+}
+
 /* Helper: write a single bit into pixel channel LSBs
  * - dst_byte points to the pixel channel byte
  * - bit_val is 0 or 1
@@ -65,60 +82,49 @@ static inline void set_lsb_bit(unsigned char *dst_byte, int bit_val, int bit_pos
 }
 
 /* Write sequential bits from buf (big-endian within each byte: msb first)
- * into the image LSBs. We consume bits starting from buf[0] MSB -> LSB.
+ * into the image LSBs, starting at stream bit bit_pos. Every channel
+ * byte carries exactly lsb_depth bits, so stream bit g lives in channel
+ * byte g / lsb_depth at LSB position g % lsb_depth. This lets the stream
+ * be written in arbitrary pieces (see StegoWriter).
  */
-static int embed_bytes_into_image(const struct Image *cover, const unsigned char *buf, size_t buf_size, int lsb_depth, struct Image *out)
+static void embed_bits_at(unsigned char *pixels, size_t bit_pos, const unsigned char *buf, size_t buf_size, int lsb_depth)
 {
-    if (!cover || !buf || !out)
-        return -1;
-    size_t capacity = compute_capacity_bytes(cover, lsb_depth);
-    if (buf_size > capacity)
-        return -2; /* not enough capacity */
-
-    /* Prepare output image as a copy of cover */
-    size_t pixel_bytes = (size_t)cover->width * cover->height * cover->channels;
-    out->pixels = malloc(pixel_bytes);
-    if (!out->pixels)
-        return -3;
-    memcpy(out->pixels, cover->pixels, pixel_bytes);
-    out->width = cover->width;
-    out->height = cover->height;
-    out->channels = cover->channels;
-
-    size_t total_bits_to_write = buf_size * 8;
-    size_t bit_index = 0; /* 0..total_bits_to_write-1 */
-
-    for (size_t px = 0; px < (size_t)cover->width * cover->height && bit_index < total_bits_to_write; ++px)
+    size_t ch = bit_pos / (size_t)lsb_depth;
+    int b = (int)(bit_pos % (size_t)lsb_depth);
+    for (size_t i = 0; i < buf_size; ++i)
     {
-        size_t base = px * cover->channels;
-        for (int ch = 0; ch < cover->channels && bit_index < total_bits_to_write; ++ch)
+        for (int k = 7; k >= 0; --k) /* msb-first */
         {
-            unsigned char *pbyte = &out->pixels[base + ch];
-            /* For each channel embed up to lsb_depth bits */
-            for (int b = 0; b < lsb_depth && bit_index < total_bits_to_write; ++b)
+            set_lsb_bit(&pixels[ch], (buf[i] >> k) & 1, b);
+            if (++b == lsb_depth)
             {
-                size_t byte_idx = bit_index / 8;
-                int bit_in_byte = 7 - (bit_index % 8); /* msb-first */
-                int bit_val = (buf[byte_idx] >> bit_in_byte) & 1;
-                /* Set the b-th LSB of pbyte to bit_val */
-                if (bit_val)
-                    *pbyte |= (1u << b);
-                else
-                    *pbyte &= ~(1u << b);
-                ++bit_index;
+                b = 0;
+                ++ch;
             }
         }
     }
+}
 
-    if (bit_index < total_bits_to_write)
+/* Read out_size bytes starting at stream bit bit_pos; the inverse of
+ * embed_bits_at(). The caller checks capacity. */
+static void extract_bits_at(const unsigned char *pixels, size_t bit_pos, unsigned char *out_buf, size_t out_size, int lsb_depth)
+{
+    size_t ch = bit_pos / (size_t)lsb_depth;
+    int b = (int)(bit_pos % (size_t)lsb_depth);
+    for (size_t i = 0; i < out_size; ++i)
     {
-        /* Unexpected: couldn't write all bits */
-        free(out->pixels);
-        out->pixels = NULL;
-        return -4;
+        unsigned v = 0;
+        for (int k = 0; k < 8; ++k)
+        {
+            v = (v << 1) | ((pixels[ch] >> b) & 1u);
+            if (++b == lsb_depth)
+            {
+                b = 0;
+                ++ch;
+            }
+        }
+        out_buf[i] = (unsigned char)v;
     }
-
-    return 0;
 }
 
 /* Read sequential bits from image LSBs into buffer (reads buf_size bytes)
@@ -138,6 +144,12 @@ static int extract_bytes_from_image(const struct Image *img, unsigned char *out_
 
     for (size_t px = 0; px < (size_t)img->width * img->height && bit_index < total_bits_to_read; ++px)
     {
+        if (px % STEGO_CANCEL_BLOCK == 0 && px)
+        {
+            if (cancel_requested())
+                return STEGO_CANCELLED;
+            progress_update(bit_index, total_bits_to_read);
+        }
         size_t base = px * img->channels;
         for (int ch = 0; ch < img->channels && bit_index < total_bits_to_read; ++ch)
         {
@@ -157,75 +169,167 @@ static int extract_bytes_from_image(const struct Image *img, unsigned char *out_
         return -3;
     return 0;
 }
-/* Public API: stego_embed */
-int stego_embed(const struct Image *cover,
-                const struct Payload *payload,
-                const struct Metadata *meta,
-                int lsb_depth,
-                struct Image *out)
+/* Public API: chunked embedding */
+int stego_embed_begin(const struct Image *cover,
+                      const struct Metadata *meta,
+                      size_t payload_size,
+                      int lsb_depth,
+                      struct StegoWriter *w,
+                      struct Image *out)
 {
-    if (!cover || !payload || !meta || !out)
+    if (!cover || !meta || !w || !out)
         return -1;
     if (lsb_depth < 1 || lsb_depth > 3)
         return -2;
 
-    /* Serialize metadata */
+    /* Serialize metadata. v2 records carry a payload checksum; it is not
+     * known yet, so a zero placeholder is written and patched at the end. */
+    struct Metadata hdr = *meta;
+    hdr.has_crc = hdr.version != METADATA_VERSION_1;
+    hdr.crc32c = 0;
     unsigned char *meta_buf = NULL;
     size_t meta_size = 0;
-    int rc = metadata_serialize(meta, &meta_buf, &meta_size);
+    int rc = metadata_serialize(&hdr, &meta_buf, &meta_size);
     if (rc != 0)
     {
         return -3;
     }
 
-    /* Build combined buffer: [meta_size(4 bytes LE)] [meta_buf] [payload->data]
+    /* Stream layout: [meta_size(4 bytes LE)] [meta_buf] [payload]
      * We prefix metadata length (uint32 LE) to help decoder know how many
      * metadata bytes to read. This convention must be matched in metadata_parse.
      */
-    size_t total_size = 4 + meta_size + payload->size;
-    unsigned char *combined = malloc(total_size);
-    if (!combined)
+    size_t total_size = 4 + meta_size + payload_size;
+
+    /* Check capacity */
+    size_t capacity = compute_capacity_bytes(cover, lsb_depth);
+    if (total_size > capacity)
+    {
+        free(meta_buf);
+        return -5; /* overflow */
+    }
+
+    /* Prepare output image as a copy of cover */
+    size_t pixel_bytes = (size_t)cover->width * cover->height * cover->channels;
+    out->pixels = malloc(pixel_bytes);
+    if (!out->pixels)
     {
         free(meta_buf);
         return -4;
     }
+    memcpy(out->pixels, cover->pixels, pixel_bytes);
+    out->width = cover->width;
+    out->height = cover->height;
+    out->channels = cover->channels;
+
+    w->out = out;
+    w->lsb_depth = lsb_depth;
+    w->bit_pos = 0;
+    w->payload_left = payload_size;
+    w->crc = 0;
+    w->crc_bit_pos = hdr.has_crc ? (4 + METADATA_V2_CRC_OFFSET) * 8 : 0;
 
     /* Little-endian 32-bit length */
-    combined[0] = (unsigned char)(meta_size & 0xFF);
-    combined[1] = (unsigned char)((meta_size >> 8) & 0xFF);
-    combined[2] = (unsigned char)((meta_size >> 16) & 0xFF);
-    combined[3] = (unsigned char)((meta_size >> 24) & 0xFF);
+    unsigned char len_buf[4];
+    len_buf[0] = (unsigned char)(meta_size & 0xFF);
+    len_buf[1] = (unsigned char)((meta_size >> 8) & 0xFF);
+    len_buf[2] = (unsigned char)((meta_size >> 16) & 0xFF);
+    len_buf[3] = (unsigned char)((meta_size >> 24) & 0xFF);
 
-    memcpy(combined + 4, meta_buf, meta_size);
-    memcpy(combined + 4 + meta_size, payload->data, payload->size);
+    embed_bits_at(out->pixels, w->bit_pos, len_buf, 4, lsb_depth);
+    w->bit_pos += 4 * 8;
+    embed_bits_at(out->pixels, w->bit_pos, meta_buf, meta_size, lsb_depth);
+    w->bit_pos += meta_size * 8;
 
-    /* Check capacity */
-    size_t capacity = compute_capacity_bytes(cover, lsb_depth);
-    if (total_size > capacity)
+    free(meta_buf);
+    return 0;
+}
+
+int stego_embed_write(struct StegoWriter *w, const unsigned char *data, size_t len)
+{
+    if (!w || !w->out || (!data && len))
+        return -1;
+    if (len > w->payload_left)
+        return -2; /* more data than announced in stego_embed_begin */
+
+    while (len > 0)
     {
-        free(meta_buf);
-        free(combined);
-        return -5; /* overflow */
+        if (cancel_requested())
+            return STEGO_CANCELLED;
+        progress_update(w->bit_pos, w->bit_pos + (uint64_t)w->payload_left * 8);
+        size_t n = len < STEGO_CANCEL_BLOCK ? len : STEGO_CANCEL_BLOCK;
+        embed_bits_at(w->out->pixels, w->bit_pos, data, n, w->lsb_depth);
+        w->bit_pos += n * 8;
+        w->payload_left -= n;
+        if (w->crc_bit_pos)
+            w->crc = crc32c_update(w->crc, data, n);
+        data += n;
+        len -= n;
     }
+    return 0;
+}
 
-    rc = embed_bytes_into_image(cover, combined, total_size, lsb_depth, out);
+int stego_embed_sink(void *writer, const unsigned char *data, size_t len)
+{
+    return stego_embed_write((struct StegoWriter *)writer, data, len);
+}
 
-    free(meta_buf);
-    free(combined);
-    return rc;
+int stego_embed_end(struct StegoWriter *w)
+{
+    if (!w || !w->out)
+        return -1;
+    if (w->payload_left != 0)
+    {
+        /* Short payload: the image would carry a truncated stream */
+        image_free(w->out);
+        w->out = NULL;
+        return -4;
+    }
+    if (w->crc_bit_pos)
+    {
+        unsigned char crc_buf[4];
+        for (int i = 0; i < 4; ++i)
+            crc_buf[i] = (unsigned char)((w->crc >> (8 * i)) & 0xFF);
+        embed_bits_at(w->out->pixels, w->crc_bit_pos, crc_buf, 4, w->lsb_depth);
+    }
+    w->out = NULL;
+    return 0;
 }
-/* Public API: stego_extract */
-int stego_extract(const struct Image *stego,
-                  struct Metadata *meta_out,
-                  struct Payload *payload_out)
+
+/* Public API: stego_embed */
+int stego_embed(const struct Image *cover,
+                const struct Payload *payload,
+                const struct Metadata *meta,
+                int lsb_depth,
+                struct Image *out)
 {
-    if (!stego || !meta_out || !payload_out)
+    if (!cover || !payload || !meta || !out)
         return -1;
 
+    struct StegoWriter w;
+    int rc = stego_embed_begin(cover, meta, payload->size, lsb_depth, &w, out);
+    if (rc != 0)
+        return rc;
+
+    rc = stego_embed_write(&w, payload->data, payload->size);
+    if (rc != 0)
+    {
+        image_free(out);
+        return rc;
+    }
+    return stego_embed_end(&w);
+}
+/* Find the metadata record by probing LSB depths 3..1. On success fills
+ * meta_out, *depth_out and *meta_len_out (record length, excluding the
+ * 4-byte length prefix). */
+static int locate_metadata(const struct Image *stego,
+                           struct Metadata *meta_out,
+                           int *depth_out,
+                           size_t *meta_len_out)
+{
     unsigned char len_buf[4];
     int lsb_depth = 0;
     size_t meta_len = 0;
-    unsigned char *meta_buf = NULL;
     int found = 0;
 
     // Probe for LSB depth by trying to find valid metadata
@@ -240,7 +344,7 @@ int stego_extract(const struct Image *stego,
         uint32_t mlen = (uint32_t)len_buf[0] | ((uint32_t)len_buf[1] << 8) | ((uint32_t)len_buf[2] << 16) | ((uint32_t)len_buf[3] << 24);
 
         // Sanity check on metadata length
-        if (mlen == 0 || mlen > 1024) // Metadata shouldn't be huge
+        if (mlen == 0 || mlen > STEGO_MAX_META_LEN) // Metadata shouldn't be huge
         {
             continue;
         }
@@ -280,13 +384,9 @@ int stego_extract(const struct Image *stego,
             found = 1;
             lsb_depth = d;
             meta_len = mlen;
-            meta_buf = mbuf; // Keep the buffer
             memcpy(meta_out, &test_meta, sizeof(struct Metadata));
         }
-        else
-        {
-            free(mbuf); // Failed, free the buffer and try next depth
-        }
+        free(mbuf);
     }
 
     if (!found)
@@ -294,20 +394,46 @@ int stego_extract(const struct Image *stego,
         return -4; // Failed to find valid metadata at any LSB depth
     }
 
+    *depth_out = lsb_depth;
+    *meta_len_out = meta_len;
+    return 0;
+}
+
+/* Public API: stego_extract */
+int stego_extract(const struct Image *stego,
+                  struct Metadata *meta_out,
+                  struct Payload *payload_out)
+{
+    if (!stego || !meta_out || !payload_out)
+        return -1;
+
+    int lsb_depth = 0;
+    size_t meta_len = 0;
+    int rc = locate_metadata(stego, meta_out, &lsb_depth, &meta_len);
+    if (rc != 0)
+        return rc;
+    if (meta_out->sharded)
+        return -12; // one part of a sharded payload, see shard.h
+
     // 4. Extract the payload
     size_t payload_size = 0;
     if (metadata_get_payload_size(meta_out, &payload_size) != 0)
     {
-        free(meta_buf);
         return -5;
     }
 
+    // The size comes from the header; make sure it fits before adding to it
+    size_t capacity = compute_capacity_bytes(stego, lsb_depth);
+    if (payload_size > capacity || 4 + meta_len > capacity - payload_size)
+    {
+        return -7;
+    }
+
     // If payload size is 0, nothing more to do
     if (payload_size == 0)
     {
         payload_out->data = NULL;
         payload_out->size = 0;
-        free(meta_buf);
         return 0;
     }
 
@@ -316,32 +442,156 @@ int stego_extract(const struct Image *stego,
     unsigned char *full_data = malloc(total_embedded_size);
     if (!full_data)
     {
-        free(meta_buf);
         return -6;
     }
 
-    if (extract_bytes_from_image(stego, full_data, total_embedded_size, lsb_depth) != 0)
+    rc = extract_bytes_from_image(stego, full_data, total_embedded_size, lsb_depth);
+    if (rc != 0)
     {
-        free(meta_buf);
         free(full_data);
-        return -7;
+        return rc == STEGO_CANCELLED ? rc : -7;
     }
 
+    if (meta_out->has_crc && crc32c_update(0, full_data + 4 + meta_len, payload_size) != meta_out->crc32c)
+    {
+        free(full_data);
+        return -10;
+    }
+
+    // A compressed plain payload is inflated straight out of the extracted
+    // stream; encrypted ones are left for the caller to decompress after
+    // decryption.
+    int inflate = meta_out->compression && !meta_out->encrypted;
+    size_t out_size = inflate ? (size_t)meta_out->original_size : payload_size;
+
     // Copy the payload part into the output struct
-    payload_out->data = malloc(payload_size);
+    payload_out->data = malloc(out_size ? out_size : 1);
     if (!payload_out->data)
     {
-        free(meta_buf);
         free(full_data);
         return -8;
     }
-    memcpy(payload_out->data, full_data + 4 + meta_len, payload_size);
-    payload_out->size = payload_size;
+    if (inflate)
+    {
+        if (decompress_buffer(meta_out->compression, full_data + 4 + meta_len, payload_size,
+                              payload_out->data, out_size) != 0)
+        {
+            free(payload_out->data);
+            payload_out->data = NULL;
+            free(full_data);
+            return -9;
+        }
+    }
+    else
+    {
+        memcpy(payload_out->data, full_data + 4 + meta_len, payload_size);
+    }
+    payload_out->size = out_size;
     payload_out->encrypted = meta_out->encrypted;
 
     // Cleanup
-    free(meta_buf);
     free(full_data);
 
     return 0;
 }
+
+/* Public API: random-access reads */
+int stego_reader_open(const struct Image *stego, struct Metadata *meta_out, struct StegoReader *r)
+{
+    if (!stego || !meta_out || !r)
+        return -1;
+
+    int lsb_depth = 0;
+    size_t meta_len = 0;
+    int rc = locate_metadata(stego, meta_out, &lsb_depth, &meta_len);
+    if (rc != 0)
+        return rc;
+
+    size_t payload_size = (size_t)meta_out->file_size;
+    size_t capacity = compute_capacity_bytes(stego, lsb_depth);
+    if (payload_size > capacity || 4 + meta_len > capacity - payload_size)
+        return -7;
+
+    r->img = stego;
+    r->lsb_depth = lsb_depth;
+    r->payload_bit_pos = (4 + meta_len) * 8;
+    r->payload_size = payload_size;
+    return 0;
+}
+
+int stego_reader_read(const struct StegoReader *r, uint64_t offset, unsigned char *buf, size_t len)
+{
+    if (!r || (!buf && len))
+        return -1;
+    if (offset > r->payload_size || len > r->payload_size - offset)
+        return -2;
+    extract_bits_at(r->img->pixels, r->payload_bit_pos + (size_t)offset * 8, buf, len, r->lsb_depth);
+    return 0;
+}
+
+/* Public API: stego_verify */
+int stego_verify(const struct Image *stego, struct Metadata *meta_out)
+{
+    if (!stego)
+        return -1;
+
+    struct Metadata meta;
+    struct StegoReader r;
+    int rc = stego_reader_open(stego, &meta, &r);
+    if (rc != 0)
+        return rc;
+    if (meta_out)
+        *meta_out = meta;
+    if (!meta.has_crc)
+        return -11;
+
+    unsigned char chunk[16 * 1024];
+    uint32_t crc = 0;
+    for (size_t off = 0; off < r.payload_size;)
+    {
+        if (cancel_requested())
+            return STEGO_CANCELLED;
+        progress_update(off, r.payload_size);
+        size_t n = r.payload_size - off < sizeof(chunk) ? r.payload_size - off : sizeof(chunk);
+        stego_reader_read(&r, off, chunk, n);
+        crc = crc32c_update(crc, chunk, n);
+        off += n;
+    }
+    return crc == meta.crc32c ? 0 : -10;
+}
+
+/* The longest header the probe accepts, read at depth 1 (one bit per
+ * channel byte), bounds how much of the image has to be decoded */
+#define STEGO_HEAD_BYTES ((4 + STEGO_MAX_META_LEN) * 8)
+
+static int probe_head(struct Image *head, struct Metadata *meta_out)
+{
+    int lsb_depth = 0;
+    size_t meta_len = 0;
+    int rc = locate_metadata(head, meta_out, &lsb_depth, &meta_len);
+    image_free(head);
+    return rc;
+}
+
+/* Public API: stego_read_metadata */
+int stego_read_metadata(const char *path, struct Metadata *meta_out)
+{
+    if (!path || !meta_out)
+        return -1;
+
+    struct Image head = {0};
+    if (image_load_head(path, STEGO_HEAD_BYTES, &head) != 0)
+        return -3;
+    return probe_head(&head, meta_out);
+}
+
+int stego_read_metadata_stream(FILE *f, struct Metadata *meta_out)
+{
+    if (!f || !meta_out)
+        return -1;
+
+    struct Image head = {0};
+    if (image_load_head_stream(f, STEGO_HEAD_BYTES, &head) != 0)
+        return -3;
+    return probe_head(&head, meta_out);
+}
@@ -0,0 +1,502 @@
+/*
+ * watch.c - Hot-folder mode (see watch.h).
+ *
+ * One inotify descriptor on the inbox is added to GLib's default main
+ * context, which the caller's thread iterates; the same context delivers
+ * the finished callbacks of the batch.c tasks, so all of the bookkeeping
+ * below runs on that one thread and needs no locking. A job starts as soon
+ * as the kernel reports the close (or rename) of its last input, and the
+ * thread sleeps in poll() otherwise: nothing here polls the filesystem.
+ *
+ * Only IN_CLOSE_WRITE and IN_MOVED_TO are acted on. IN_CREATE or
+ * IN_MODIFY would fire while a writer is still going; a close is the
+ * writer saying it is done. Files found by listing the inbox (at start,
+ * or after the event queue overflowed) carry no such promise, so they are
+ * only taken once they have been left alone for WATCH_SETTLE_SECONDS.
+ */
+
+#include "../include/watch.h"
+#include "../include/batch.h"
+#include "../include/stego_core.h"
+#include "../include/metadata.h"
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WATCH_PROCESSED_DIR ".processed"
+#define WATCH_FAILED_DIR ".failed"
+#define WATCH_SETTLE_SECONDS 2
+#define WATCH_EVENT_BUFFER 16384
+
+typedef struct
+{
+    const char *inbox;
+    const char *outbox;
+    const struct WatchOptions *opts;
+    watch_report_fn report;
+    void *report_ctx;
+
+    GHashTable *claimed;  /* names in the inbox waiting for a partner or in a job */
+    GHashTable *covers;   /* stem -> name of a cover waiting for its payload */
+    GHashTable *payloads; /* stem -> name of a payload waiting for its cover */
+    guint running;
+    guint serial; /* makes staging names unique */
+    guint rescan_id;
+    gboolean stopping;
+    gboolean lost_inbox;
+} Watcher;
+
+typedef struct
+{
+    Watcher *w;
+    char *inputs[2]; /* names in the inbox; a decode has one */
+    char *staging;   /* encode: temporary file; decode: temporary directory */
+    char *final_path; /* encode only */
+    GTask *task;
+} WatchJob;
+
+typedef enum
+{
+    FILE_STEGO,
+    FILE_COVER,
+    FILE_PAYLOAD,
+    FILE_UNREADABLE
+} FileKind;
+
+static void scan_inbox(Watcher *w);
+
+static char *inbox_path(const Watcher *w, const char *name)
+{
+    return g_strdup_printf("%s/%s", w->inbox, name);
+}
+
+/* "report.final.pdf" -> "report.final" */
+static char *name_stem(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot && dot != name ? g_strndup(name, (gsize)(dot - name)) : g_strdup(name);
+}
+
+/* From the content, like stego_scan_dir(): only PNG and BMP can carry a
+ * payload, JPEG is still fine as a cover (batch.c converts it) */
+static FileKind classify(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return FILE_UNREADABLE;
+
+    unsigned char magic[4] = {0};
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    FileKind kind = FILE_PAYLOAD;
+    bool png = n == 4 && memcmp(magic, "\x89PNG", 4) == 0;
+    bool bmp = n >= 2 && magic[0] == 'B' && magic[1] == 'M';
+    bool jpeg = n >= 3 && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF;
+    if (png || bmp)
+    {
+        struct Metadata meta;
+        rewind(f);
+        kind = stego_read_metadata_stream(f, &meta) == 0 ? FILE_STEGO : FILE_COVER;
+    }
+    else if (jpeg)
+    {
+        kind = FILE_COVER;
+    }
+    fclose(f);
+    return kind;
+}
+
+/* A decode's staging directory is flat: neither a payload's file name nor
+ * an archive's entry names may contain a '/' (payload_name_ok) */
+static void remove_staging_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir)
+    {
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL)
+        {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+                continue;
+            char *entry = g_strdup_printf("%s/%s", path, de->d_name);
+            remove(entry);
+            g_free(entry);
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+/* ---------- finishing jobs ---------- */
+
+/* Move the entries of a decode's staging directory into the outbox. Each
+ * rename is atomic; *moved counts them and *last names one. */
+static int publish_staging_dir(const char *staging, const char *outbox, guint *moved, char **last)
+{
+    DIR *dir = opendir(staging);
+    if (!dir)
+        return -1;
+    int rc = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        char *from = g_strdup_printf("%s/%s", staging, de->d_name);
+        char *to = g_strdup_printf("%s/%s", outbox, de->d_name);
+        if (rename(from, to) == 0)
+        {
+            ++*moved;
+            g_free(*last);
+            *last = to;
+            to = NULL;
+        }
+        else
+        {
+            rc = -1;
+        }
+        g_free(from);
+        g_free(to);
+    }
+    closedir(dir);
+    return rc;
+}
+
+static void retire_input(Watcher *w, const char *name, gboolean success)
+{
+    char *dir = inbox_path(w, success ? WATCH_PROCESSED_DIR : WATCH_FAILED_DIR);
+    char *from = inbox_path(w, name);
+    char *to = g_strdup_printf("%s/%s", dir, name);
+    if (mkdir(dir, 0700) == 0 || errno == EEXIST)
+        rename(from, to); /* if this fails the file stays, unclaimed */
+    g_hash_table_remove(w->claimed, name);
+    g_free(dir);
+    g_free(from);
+    g_free(to);
+}
+
+static void watch_job_free(WatchJob *job)
+{
+    g_free(job->inputs[0]);
+    g_free(job->inputs[1]);
+    g_free(job->staging);
+    g_free(job->final_path);
+    g_free(job);
+}
+
+/* Runs on the watching thread, from the context iterated by stego_watch() */
+static void watch_job_finished(gpointer user_data, gboolean success, const char *message)
+{
+    WatchJob *job = user_data;
+    Watcher *w = job->w;
+    char *output = NULL;
+
+    if (success && job->final_path)
+    {
+        if (rename(job->staging, job->final_path) == 0)
+            output = g_strdup(job->final_path);
+    }
+    else if (success)
+    {
+        guint moved = 0;
+        char *last = NULL;
+        if (publish_staging_dir(job->staging, w->outbox, &moved, &last) == 0 && moved > 0)
+            output = moved == 1 ? g_strdup(last) : g_strdup_printf("%s (%u files)", w->outbox, moved);
+        g_free(last);
+    }
+    if (success && !output)
+    {
+        success = FALSE;
+        message = "Cannot move the output into the outbox";
+    }
+
+    /* whatever is left of the staging output is a failure's leftovers */
+    if (job->final_path)
+        remove(job->staging);
+    else if (job->staging)
+        remove_staging_dir(job->staging);
+
+    char *input = job->inputs[1] ? g_strdup_printf("%s + %s", job->inputs[0], job->inputs[1]) : g_strdup(job->inputs[0]);
+    for (int i = 0; i < 2; ++i)
+    {
+        if (job->inputs[i])
+            retire_input(w, job->inputs[i], success);
+    }
+    w->report(w->report_ctx, input, output, success, message);
+    g_free(input);
+    g_free(output);
+
+    if (job->task)
+        g_object_unref(job->task);
+    watch_job_free(job);
+    w->running--;
+}
+
+/* ---------- starting jobs ---------- */
+
+static void start_job(WatchJob *job, const char *refused)
+{
+    job->w->running++;
+    if (!job->task)
+        watch_job_finished(job, FALSE, refused); /* reported like any failure */
+}
+
+static void start_encode(Watcher *w, const char *stem, const char *cover, const char *payload)
+{
+    WatchJob *job = g_new0(WatchJob, 1);
+    job->w = w;
+    job->inputs[0] = g_strdup(cover);
+    job->inputs[1] = g_strdup(payload);
+    job->staging = g_strdup_printf("%s/.stego-%u-%s.png", w->outbox, ++w->serial, stem);
+    job->final_path = g_strdup_printf("%s/%s.png", w->outbox, stem);
+
+    char *cover_path = inbox_path(w, cover);
+    char *payload_path = inbox_path(w, payload);
+    job->task = batch_encode_async(cover_path, payload_path, job->staging, w->opts->lsb_depth, w->opts->password,
+                                   w->opts->cipher, NULL, BATCH_PRIORITY_NORMAL, watch_job_finished, job);
+    g_free(cover_path);
+    g_free(payload_path);
+    start_job(job, "Invalid job");
+}
+
+static void start_decode(Watcher *w, const char *name)
+{
+    WatchJob *job = g_new0(WatchJob, 1);
+    job->w = w;
+    job->inputs[0] = g_strdup(name);
+    job->staging = g_strdup_printf("%s/.stego-XXXXXX", w->outbox);
+    if (!mkdtemp(job->staging))
+    {
+        g_free(job->staging); /* its contents are undefined now */
+        job->staging = NULL;
+        start_job(job, "Cannot create a directory in the outbox");
+        return;
+    }
+
+    char *path = inbox_path(w, name);
+    job->task = batch_decode_async(path, job->staging, w->opts->password, BATCH_PRIORITY_NORMAL, watch_job_finished,
+                                   job);
+    g_free(path);
+    start_job(job, "Invalid job");
+}
+
+/* Pair a cover or payload with its partner of the same stem, or keep it
+ * until the partner arrives. A second file of the same kind and stem
+ * replaces the first, which stays in the inbox unclaimed. */
+static void pair_input(Watcher *w, const char *name, gboolean is_cover)
+{
+    GHashTable *mine = is_cover ? w->covers : w->payloads;
+    GHashTable *theirs = is_cover ? w->payloads : w->covers;
+    char *stem = name_stem(name);
+    const char *partner = g_hash_table_lookup(theirs, stem);
+    if (partner)
+    {
+        start_encode(w, stem, is_cover ? name : partner, is_cover ? partner : name);
+        g_hash_table_remove(theirs, stem);
+        g_free(stem);
+        return;
+    }
+
+    const char *previous = g_hash_table_lookup(mine, stem);
+    if (previous)
+        g_hash_table_remove(w->claimed, previous);
+    g_hash_table_replace(mine, stem, g_strdup(name)); /* takes stem */
+}
+
+/* ---------- inbox events ---------- */
+
+/* settle: the file was found by listing rather than by an event, so it
+ * may still be being written. Returns FALSE if it was left for later. */
+static gboolean consider_file(Watcher *w, const char *name, gboolean settle)
+{
+    if (name[0] == '.' || g_hash_table_contains(w->claimed, name))
+        return TRUE;
+
+    char *path = inbox_path(w, name);
+    struct stat st;
+    /* an empty file is usually one that was just created: its data comes
+     * with a later close */
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        g_free(path);
+        return TRUE;
+    }
+    if (settle && time(NULL) - st.st_mtime < WATCH_SETTLE_SECONDS)
+    {
+        g_free(path);
+        return FALSE;
+    }
+
+    FileKind kind = classify(path);
+    g_free(path);
+    if (kind == FILE_UNREADABLE)
+        return TRUE;
+
+    g_hash_table_add(w->claimed, g_strdup(name));
+    if (kind == FILE_STEGO)
+        start_decode(w, name);
+    else
+        pair_input(w, name, kind == FILE_COVER);
+    return TRUE;
+}
+
+static gboolean on_rescan(gpointer user_data)
+{
+    Watcher *w = user_data;
+    w->rescan_id = 0;
+    scan_inbox(w);
+    return G_SOURCE_REMOVE;
+}
+
+/* Files that are still settling get another look once they may have */
+static void scan_inbox(Watcher *w)
+{
+    DIR *dir = opendir(w->inbox);
+    if (!dir)
+        return;
+    gboolean deferred = FALSE;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (!consider_file(w, de->d_name, TRUE))
+            deferred = TRUE;
+    }
+    closedir(dir);
+    if (deferred && w->rescan_id == 0)
+        w->rescan_id = g_timeout_add_seconds(WATCH_SETTLE_SECONDS, on_rescan, w);
+}
+
+static gboolean on_inotify(gint fd, GIOCondition condition, gpointer user_data)
+{
+    Watcher *w = user_data;
+    (void)condition;
+
+    _Alignas(struct inotify_event) char buf[WATCH_EVENT_BUFFER];
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break; /* EAGAIN: drained */
+        for (char *p = buf; p < buf + n;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                scan_inbox(w);
+            }
+            else if (ev->mask & IN_IGNORED)
+            {
+                /* the inbox was deleted or unmounted */
+                w->lost_inbox = TRUE;
+                w->stopping = TRUE;
+            }
+            else if (ev->len > 0 && !(ev->mask & IN_ISDIR))
+            {
+                consider_file(w, ev->name, FALSE);
+            }
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_stop_signal(gpointer user_data)
+{
+    Watcher *w = user_data;
+    w->stopping = TRUE;
+    return G_SOURCE_CONTINUE;
+}
+
+/* ---------- public API ---------- */
+
+/* True if dir is the directory top or lies anywhere below it */
+static int dir_is_within(const char *dir, const struct stat *top)
+{
+    char *path = realpath(dir, NULL);
+    if (!path)
+        return 0;
+    int within = 0;
+    for (;;)
+    {
+        struct stat st;
+        if (stat(path, &st) == 0 && st.st_dev == top->st_dev && st.st_ino == top->st_ino)
+        {
+            within = 1;
+            break;
+        }
+        char *slash = strrchr(path, '/');
+        if (!slash || path[1] == '\0')
+            break; /* checked "/" */
+        slash[slash == path ? 1 : 0] = '\0';
+    }
+    free(path);
+    return within;
+}
+
+int stego_watch(const char *inbox, const char *outbox, const struct WatchOptions *opts, watch_report_fn report,
+                void *ctx)
+{
+    if (!inbox || !outbox || !opts || !report)
+        return -1;
+
+    struct stat st;
+    if (stat(outbox, &st) != 0 || !S_ISDIR(st.st_mode) || access(outbox, W_OK | X_OK) != 0)
+        return -3;
+    /* Outputs landing in the inbox would be picked up again, forever */
+    if (stat(inbox, &st) == 0 && dir_is_within(outbox, &st))
+        return -3;
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return -2;
+    if (inotify_add_watch(fd, inbox, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0)
+    {
+        close(fd);
+        return -2;
+    }
+
+    Watcher w = {0};
+    w.inbox = inbox;
+    w.outbox = outbox;
+    w.opts = opts;
+    w.report = report;
+    w.report_ctx = ctx;
+    w.claimed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    w.covers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    w.payloads = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    guint io_id = g_unix_fd_add(fd, G_IO_IN, on_inotify, &w);
+    guint int_id = g_unix_signal_add(SIGINT, on_stop_signal, &w);
+    guint term_id = g_unix_signal_add(SIGTERM, on_stop_signal, &w);
+
+    /* The watch is already in place, so a file landing while the inbox is
+     * listed is seen at least once; claimed keeps it from being seen twice */
+    scan_inbox(&w);
+
+    while (!w.stopping)
+        g_main_context_iteration(NULL, TRUE);
+
+    /* take nothing new, but let what was started finish */
+    g_source_remove(io_id);
+    if (w.rescan_id)
+        g_source_remove(w.rescan_id);
+    while (w.running > 0)
+        g_main_context_iteration(NULL, TRUE);
+
+    g_source_remove(int_id);
+    g_source_remove(term_id);
+    close(fd);
+    g_hash_table_destroy(w.claimed);
+    g_hash_table_destroy(w.covers);
+    g_hash_table_destroy(w.payloads);
+    return w.lost_inbox ? -2 : 0;
+}